@@ -10,14 +10,20 @@
 
 #include "cache.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
 
 #include "cmusfm.h"
 #include "debug.h"
+#include "index.h"
 
 
 /* Return the actual size of the given cache record structure. */
@@ -40,54 +46,86 @@ static uint8_t get_cache_record_checksum2(const struct cmusfm_cache_record *reco
 			get_cache_record_size(record) - ((char *)&record->timestamp - (char *)record));
 }
 
-/* Copy scrobbler track info into the cache record structure. Returned
- * pointer has to be freed by the `free` function. */
+/* The number of records written before the group commit. */
+#define CACHE_SYNC_BATCH 16
+
+/* Time (in seconds) after which the failed compaction might be retried. */
+#define CACHE_COMPACT_RETRY_DELAY (10 * 60)
+
+/* Cache file writer. The file is kept open in the append mode, so every
+ * record is written with a single write() call, and records are serialized
+ * into the reusable buffer. */
+static struct {
+	int fd;
+	char *buffer;
+	size_t size;
+	/* records written since the last synchronization */
+	unsigned int pending;
+	/* the number of records in the cache file */
+	size_t records;
+	/* the time of the last failed compaction */
+	time_t compact_failed;
+} writer = { .fd = -1 };
+
+static size_t cache_count_records(void);
+static void cache_compact(void);
+
+/* Serialize scrobbler track info into the cache record structure. Returned
+ * pointer points to the writer buffer, so it is valid until the next call.
+ * Upon error, NULL is returned. */
 static struct cmusfm_cache_record *get_cache_record(const scrobbler_trackinfo_t *sb_tinf) {
 
+	struct cmusfm_cache_record header = {
+		.signature = CMUSFM_CACHE_SIGNATURE,
+		.timestamp = sb_tinf->timestamp,
+		.track_number = sb_tinf->track_number,
+		.duration = sb_tinf->duration,
+	};
 	struct cmusfm_cache_record *record;
+	size_t size;
 	char *ptr;
 
-	/* allocate memory for the initial record data (header) */
-	record = (struct cmusfm_cache_record *)calloc(1, sizeof(*record));
-
-	record->signature = CMUSFM_CACHE_SIGNATURE;
-	record->timestamp = sb_tinf->timestamp;
-	record->track_number = sb_tinf->track_number;
-	record->duration = sb_tinf->duration;
-
 	if (sb_tinf->artist)
-		record->len_artist = strlen(sb_tinf->artist) + 1;
+		header.len_artist = strlen(sb_tinf->artist) + 1;
 	if (sb_tinf->album)
-		record->len_album = strlen(sb_tinf->album) + 1;
+		header.len_album = strlen(sb_tinf->album) + 1;
 	if (sb_tinf->track)
-		record->len_track = strlen(sb_tinf->track) + 1;
+		header.len_track = strlen(sb_tinf->track) + 1;
 	if (sb_tinf->album_artist)
-		record->len_album_artist = strlen(sb_tinf->album_artist) + 1;
+		header.len_album_artist = strlen(sb_tinf->album_artist) + 1;
 	if (sb_tinf->mb_track_id)
-		record->len_mb_track_id = strlen(sb_tinf->mb_track_id) + 1;
+		header.len_mb_track_id = strlen(sb_tinf->mb_track_id) + 1;
+
+	/* enlarge the buffer for string data payload */
+	if ((size = get_cache_record_size(&header)) > writer.size) {
+		if ((ptr = realloc(writer.buffer, size)) == NULL)
+			return NULL;
+		writer.buffer = ptr;
+		writer.size = size;
+	}
 
-	/* enlarge allocated memory for string data payload */
-	record = (struct cmusfm_cache_record *)realloc(record, get_cache_record_size(record));
+	record = (struct cmusfm_cache_record *)writer.buffer;
+	memcpy(record, &header, sizeof(header));
 	ptr = (char *)&record[1];
 
 	if (record->len_artist) {
-		strcpy(ptr, sb_tinf->artist);
+		memcpy(ptr, sb_tinf->artist, record->len_artist);
 		ptr += record->len_artist;
 	}
 	if (record->len_album) {
-		strcpy(ptr, sb_tinf->album);
+		memcpy(ptr, sb_tinf->album, record->len_album);
 		ptr += record->len_album;
 	}
 	if (record->len_track) {
-		strcpy(ptr, sb_tinf->track);
+		memcpy(ptr, sb_tinf->track, record->len_track);
 		ptr += record->len_track;
 	}
 	if (record->len_album_artist) {
-		strcpy(ptr, sb_tinf->album_artist);
+		memcpy(ptr, sb_tinf->album_artist, record->len_album_artist);
 		ptr += record->len_album_artist;
 	}
 	if (record->len_mb_track_id) {
-		strcpy(ptr, sb_tinf->mb_track_id);
+		memcpy(ptr, sb_tinf->mb_track_id, record->len_mb_track_id);
 		ptr += record->len_mb_track_id;
 	}
 
@@ -97,10 +135,74 @@ static struct cmusfm_cache_record *get_cache_record(const scrobbler_trackinfo_t
 	return record;
 }
 
-/* Write data, which should be submitted later, to the cache file. */
+/* Convert record header from the host endianness to the "universal" one. */
+static void cache_record_hton(struct cmusfm_cache_record *record) {
+	record->signature = htons(record->signature);
+	record->timestamp = htonl(record->timestamp);
+	record->track_number = htons(record->track_number);
+	record->duration = htons(record->duration);
+	record->len_artist = htons(record->len_artist);
+	record->len_album = htons(record->len_album);
+	record->len_track = htons(record->len_track);
+	record->len_album_artist = htons(record->len_album_artist);
+	record->len_mb_track_id = htons(record->len_mb_track_id);
+}
+
+/* Convert record header from the "universal" endianness to the host one. */
+static void cache_record_ntoh(struct cmusfm_cache_record *record) {
+	record->signature = ntohs(record->signature);
+	record->timestamp = ntohl(record->timestamp);
+	record->track_number = ntohs(record->track_number);
+	record->duration = ntohs(record->duration);
+	record->len_artist = ntohs(record->len_artist);
+	record->len_album = ntohs(record->len_album);
+	record->len_track = ntohs(record->len_track);
+	record->len_album_artist = ntohs(record->len_album_artist);
+	record->len_mb_track_id = ntohs(record->len_mb_track_id);
+}
+
+/* Open the cache file for appending. The file is reopened if it has been
+ * removed (e.g. drained by other process) since the last call. */
+static int cache_writer_open(void) {
+
+	struct stat st;
+
+	if (writer.fd != -1) {
+		if (fstat(writer.fd, &st) == 0 && st.st_nlink > 0)
+			return writer.fd;
+		/* there is no point in synchronizing removed file */
+		close(writer.fd);
+		writer.pending = 0;
+	}
+
+	/* the number of records is required for the quota only */
+	writer.records = config.cache_max_records != 0 ? cache_count_records() : 0;
+
+	writer.fd = open(cmusfm_cache_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	return writer.fd;
+}
+
+/* Check whether the cache file exceeds the configured quota. */
+static bool cache_writer_is_over_quota(void) {
+
+	struct stat st;
+
+	if (config.cache_max_records != 0 && writer.records > config.cache_max_records)
+		return true;
+	if (config.cache_max_size != 0 && fstat(writer.fd, &st) == 0 &&
+			(unsigned long)st.st_size > config.cache_max_size)
+		return true;
+
+	return false;
+}
+
+/* Write data, which should be submitted later, to the cache file. Data is
+ * synchronized with the storage device according to the configured cache
+ * synchronization policy. If the cache file exceeds the configured quota,
+ * it is compacted. The failed compaction is not retried upon every update,
+ * but after the retry delay or after the successful drain. */
 void cmusfm_cache_update(const scrobbler_trackinfo_t *sb_tinf) {
 
-	FILE *f;
 	struct cmusfm_cache_record *record;
 	size_t record_size;
 
@@ -109,137 +211,692 @@ void cmusfm_cache_update(const scrobbler_trackinfo_t *sb_tinf) {
 			sb_tinf->artist, sb_tinf->album, sb_tinf->album_artist,
 			sb_tinf->track_number, sb_tinf->track, sb_tinf->duration);
 
-	if ((f = fopen(cmusfm_cache_file, "a")) == NULL)
+	if (cache_writer_open() == -1)
+		return;
+	if ((record = get_cache_record(sb_tinf)) == NULL)
 		return;
 
-	record = get_cache_record(sb_tinf);
 	record_size = get_cache_record_size(record);
+	cache_record_hton(record);
 
-	/* convert host endianness to the "universal" one */
-	record->signature = htons(record->signature);
-	record->timestamp = htonl(record->timestamp);
-	record->track_number = htons(record->track_number);
-	record->duration = htons(record->duration);
-	record->len_artist = htons(record->len_artist);
-	record->len_album = htons(record->len_album);
-	record->len_track = htons(record->len_track);
-	record->len_album_artist = htons(record->len_album_artist);
-	record->len_mb_track_id = htons(record->len_mb_track_id);
+	/* partially written record is quarantined by the reader */
+	if (write(writer.fd, record, record_size) != (ssize_t)record_size) {
+		debug("Cache write error: %s", strerror(errno));
+		return;
+	}
 
-	fwrite(record, record_size, 1, f);
+	switch (config.cache_sync) {
+	case CMUSFM_CACHE_SYNC_NONE:
+		break;
+	case CMUSFM_CACHE_SYNC_BATCH:
+		if (++writer.pending >= CACHE_SYNC_BATCH)
+			cmusfm_cache_sync();
+		break;
+	case CMUSFM_CACHE_SYNC_ALWAYS:
+		writer.pending++;
+		cmusfm_cache_sync();
+		break;
+	}
+
+	writer.records++;
+	if (cache_writer_is_over_quota() &&
+			time(NULL) - writer.compact_failed >= CACHE_COMPACT_RETRY_DELAY)
+		cache_compact();
 
-	free(record);
-	fclose(f);
 }
 
-/* Submit tracks saved in the cache file. */
-void cmusfm_cache_submit(scrobbler_session_t *sbs) {
+/* Synchronize records written since the last synchronization with the
+ * storage device - group commit for the batch synchronization policy. */
+void cmusfm_cache_sync(void) {
+
+	if (writer.fd == -1 || writer.pending == 0)
+		return;
+
+	debug("Cache sync: %u", writer.pending);
+	if (fdatasync(writer.fd) == -1)
+		debug("Cache sync error: %s", strerror(errno));
+	writer.pending = 0;
+
+}
+
+/* Synchronize pending records and close the cache file. */
+void cmusfm_cache_close(void) {
 
-	char rd_buff[4096];
+	if (writer.fd != -1) {
+		cmusfm_cache_sync();
+		close(writer.fd);
+		writer.fd = -1;
+	}
+
+	free(writer.buffer);
+	writer.buffer = NULL;
+	writer.size = 0;
+
+}
+
+/* Cache file reader with the sliding window buffer. */
+struct cache_reader {
 	FILE *f;
-	scrobbler_trackinfo_t sb_tinf;
-	struct cmusfm_cache_record *record;
-	size_t rd_len, record_size;
-	char *ptr;
+	/* file offset of the buffer data */
+	long offset;
+	char *data;
+	size_t size;
+	size_t len;
+	size_t pos;
+	/* do not move skipped data to side files */
+	bool dry_run;
+	/* quarantine file for damaged data */
+	FILE *fq;
+	size_t damaged;
+	/* file offset up to which damaged data has been already quarantined */
+	long quarantined;
+	/* archive file for expired records */
+	FILE *fa;
+	size_t expired;
+};
+
+/* Open the cache file reader at the given file offset. Upon error, -1 is
+ * returned - reader does not have to be closed in such case. */
+static int cache_reader_open(struct cache_reader *r, long offset) {
+
+	memset(r, 0, sizeof(*r));
+	r->offset = offset;
+	r->size = 4096;
+
+	if ((r->f = fopen(cmusfm_cache_file, "r")) == NULL)
+		return -1;
+	if ((r->data = malloc(r->size)) == NULL ||
+			fseek(r->f, r->offset, SEEK_SET) == -1) {
+		fclose(r->f);
+		free(r->data);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void cache_reader_close(struct cache_reader *r) {
+	fclose(r->f);
+	if (r->fq != NULL)
+		fclose(r->fq);
+	if (r->fa != NULL)
+		fclose(r->fa);
+	free(r->data);
+}
+
+/* Make sure that at least n bytes are available in the reader buffer at
+ * the current position. The buffer is enlarged if required. Note, that the
+ * maximal record size is limited by the 16-bit length fields, so the buffer
+ * can not grow indefinitely. Upon EOF false is returned. */
+static bool cache_reader_fill(struct cache_reader *r, size_t n) {
+
+	size_t rd_len;
+	char *tmp;
+
+	if (r->len - r->pos >= n)
+		return true;
+
+	/* discard already processed data */
+	memmove(r->data, &r->data[r->pos], r->len - r->pos);
+	r->offset += r->pos;
+	r->len -= r->pos;
+	r->pos = 0;
+
+	if (n > r->size) {
+		if ((tmp = realloc(r->data, n)) == NULL)
+			return false;
+		r->data = tmp;
+		r->size = n;
+	}
+
+	while (r->len < n) {
+		if ((rd_len = fread(&r->data[r->len], 1, r->size - r->len, r->f)) == 0)
+			return false;
+		r->len += rd_len;
+	}
+
+	return true;
+}
+
+/* Move data from the current position up to the given one into the file
+ * named after the cache file with the given suffix. */
+static void cache_reader_move(struct cache_reader *r, FILE **f,
+		const char *suffix, size_t end) {
+
+	if (*f == NULL && !r->dry_run) {
+		char *fname = malloc(strlen(cmusfm_cache_file) + strlen(suffix) + 1);
+		if (fname != NULL) {
+			sprintf(fname, "%s%s", cmusfm_cache_file, suffix);
+			*f = fopen(fname, "a");
+			free(fname);
+		}
+	}
+
+	if (*f != NULL)
+		fwrite(&r->data[r->pos], 1, end - r->pos, *f);
+
+	r->pos = end;
+}
 
-	debug("Cache submit");
+/* Move damaged data from the current position up to the given one into
+ * the quarantine file. Data which has been already quarantined (e.g. by the
+ * drain resumed from the position before the damaged data) is skipped. */
+static void cache_reader_quarantine(struct cache_reader *r, size_t end) {
 
-	if ((f = fopen(cmusfm_cache_file, "r")) == NULL)
+	long start = r->offset + (long)r->pos;
+
+	if (r->quarantined > start)
+		r->pos += r->quarantined - start < (long)(end - r->pos) ?
+			(size_t)(r->quarantined - start) : end - r->pos;
+	if (r->pos == end)
 		return;
 
-	/* read file until EOF */
-	while (!feof(f)) {
-		rd_len = fread(rd_buff, 1, sizeof(rd_buff), f);
-		record = (struct cmusfm_cache_record *)rd_buff;
-
-		/* iterate while there is no enough data for full cache record header */
-		while (((char *)record - rd_buff) + sizeof(*record) <= rd_len) {
-
-			/* convert "universal" endianness to the host one */
-			record->signature = ntohs(record->signature);
-			record->timestamp = ntohl(record->timestamp);
-			record->track_number = ntohs(record->track_number);
-			record->duration = ntohs(record->duration);
-			record->len_artist = ntohs(record->len_artist);
-			record->len_album = ntohs(record->len_album);
-			record->len_track = ntohs(record->len_track);
-			record->len_album_artist = ntohs(record->len_album_artist);
-			record->len_mb_track_id = ntohs(record->len_mb_track_id);
-
-			/* validate record type and first-stage data integration */
-			if (record->signature != CMUSFM_CACHE_SIGNATURE ||
-					record->checksum1 != get_cache_record_checksum1(record)) {
-				fprintf(stderr, "ERROR: Invalid cache record signature\n");
-				debug("Signature: %x, checksum: %x", record->signature, record->checksum1);
-				goto return_failure;
-			}
+	r->damaged += end - r->pos;
+	cache_reader_move(r, &r->fq, ".corrupt", end);
+	r->quarantined = r->offset + (long)end;
 
-			record_size = get_cache_record_size(record);
-			debug("Record size: %ld", record_size);
+}
 
-			/* break if current record is truncated */
-			if (((char *)record - rd_buff) + record_size > rd_len)
-				break;
+/* Move the expired record at the current position into the archive file.
+ * Record header has to be in the "universal" endianness. */
+static void cache_reader_archive(struct cache_reader *r, size_t record_size) {
+	r->expired++;
+	cache_reader_move(r, &r->fa, ".expired", r->pos + record_size);
+}
 
-			/* check for second-stage data integration */
-			if (record->checksum2 != get_cache_record_checksum2(record)) {
-				fprintf(stderr, "ERROR: Cache record data corrupted\n");
-				goto return_failure;
-			}
+/* Skip damaged data at the current position up to the next record signature
+ * found in the reader buffer. If there is no signature in the buffer, the
+ * whole buffer (except the last byte which might be the first part of the
+ * signature) is skipped. */
+static void cache_reader_resync(struct cache_reader *r) {
 
-			/* restore scrobbler track info structure from cache */
-			memset(&sb_tinf, 0, sizeof(sb_tinf));
-			sb_tinf.timestamp = record->timestamp;
-			sb_tinf.track_number = record->track_number;
-			sb_tinf.duration = record->duration;
-			ptr = (char *)&record[1];
+	const char *end = &r->data[r->len];
+	const char *ptr = &r->data[r->pos + 1];
 
-			if (record->len_artist) {
-				sb_tinf.artist = ptr;
-				ptr += record->len_artist;
-			}
-			if (record->len_album) {
-				sb_tinf.album = ptr;
-				ptr += record->len_album;
-			}
-			if (record->len_track) {
-				sb_tinf.track = ptr;
-				ptr += record->len_track;
-			}
-			if (record->len_album_artist) {
-				sb_tinf.album_artist = ptr;
-				ptr += record->len_album_artist;
-			}
-			if (record->len_mb_track_id) {
-				sb_tinf.mb_track_id = ptr;
-				ptr += record->len_mb_track_id;
+	while ((ptr = memchr(ptr, CMUSFM_CACHE_SIGNATURE >> 8, end - ptr)) != NULL) {
+		if (ptr + 1 == end || ptr[1] == (CMUSFM_CACHE_SIGNATURE & 0xFF))
+			break;
+		ptr++;
+	}
+
+	cache_reader_quarantine(r, ptr != NULL ? (size_t)(ptr - r->data) : r->len);
+	debug("Cache resync: %zu", r->damaged);
+
+}
+
+/* Report damaged data range, which has been moved to the quarantine. */
+static void cache_reader_report(struct cache_reader *r) {
+	if (r->damaged == 0 || r->dry_run)
+		return;
+	fprintf(stderr, "ERROR: Cache file corrupted: %zu bytes moved to %s.corrupt\n",
+			r->damaged, cmusfm_cache_file);
+	r->damaged = 0;
+}
+
+/* Get the next valid record from the cache file. Damaged records are moved
+ * to the quarantine file and the reader resynchronizes with the next valid
+ * record, so a partial write after a crash costs one record, not the whole
+ * cache. Returned record header is converted to the host endianness, and
+ * the record is located at the current reader position. Upon EOF, NULL is
+ * returned. */
+static struct cmusfm_cache_record *cache_reader_next(struct cache_reader *r) {
+
+	struct cmusfm_cache_record *record;
+	size_t record_size;
+
+	/* iterate while there is enough data for full cache record header */
+	while (cache_reader_fill(r, sizeof(*record))) {
+
+		record = (struct cmusfm_cache_record *)&r->data[r->pos];
+		cache_record_ntoh(record);
+
+		/* validate record type and first-stage data integration */
+		if (record->signature != CMUSFM_CACHE_SIGNATURE ||
+				record->checksum1 != get_cache_record_checksum1(record)) {
+			debug("Signature: %x, checksum: %x", record->signature, record->checksum1);
+			goto resync;
+		}
+
+		record_size = get_cache_record_size(record);
+
+		/* truncated record at the end of the file */
+		if (!cache_reader_fill(r, record_size)) {
+			record = (struct cmusfm_cache_record *)&r->data[r->pos];
+			goto resync;
+		}
+
+		/* buffer might have been moved */
+		record = (struct cmusfm_cache_record *)&r->data[r->pos];
+
+		/* check for second-stage data integration */
+		if (record->checksum2 != get_cache_record_checksum2(record)) {
+			debug("Data checksum: %x", record->checksum2);
+			goto resync;
+		}
+
+		cache_reader_report(r);
+		return record;
+
+resync:
+		/* restore original data and look for the next record */
+		cache_record_hton(record);
+		cache_reader_resync(r);
+	}
+
+	/* trailing data which is too short for a record header */
+	if (r->pos != r->len)
+		cache_reader_quarantine(r, r->len);
+
+	cache_reader_report(r);
+	return NULL;
+}
+
+/* Check whether the record is outside the service acceptance window. Such
+ * record would be ignored by the service, so there is no point in sending
+ * it. Record header has to be in the host endianness. */
+static bool cache_record_is_expired(const struct cmusfm_cache_record *record,
+		time_t now) {
+	return now - (time_t)record->timestamp > SCROBBLER_MAX_AGE;
+}
+
+/* Restore scrobbler track info structure from the cache record. Record
+ * header has to be in the host endianness. */
+static void cache_record_get_trackinfo(const struct cmusfm_cache_record *record,
+		scrobbler_trackinfo_t *sb_tinf) {
+
+	char *ptr = (char *)&record[1];
+
+	memset(sb_tinf, 0, sizeof(*sb_tinf));
+	sb_tinf->timestamp = record->timestamp;
+	sb_tinf->track_number = record->track_number;
+	sb_tinf->duration = record->duration;
+
+	if (record->len_artist) {
+		sb_tinf->artist = ptr;
+		ptr += record->len_artist;
+	}
+	if (record->len_album) {
+		sb_tinf->album = ptr;
+		ptr += record->len_album;
+	}
+	if (record->len_track) {
+		sb_tinf->track = ptr;
+		ptr += record->len_track;
+	}
+	if (record->len_album_artist) {
+		sb_tinf->album_artist = ptr;
+		ptr += record->len_album_artist;
+	}
+	if (record->len_mb_track_id) {
+		sb_tinf->mb_track_id = ptr;
+		ptr += record->len_mb_track_id;
+	}
+
+}
+
+/* Check whether the submission has failed due to the network or service
+ * unavailability. In such case the submission should be retried later. */
+static bool cache_is_transient_failure(scrobbler_session_t *sbs,
+		scrobbler_status_t status) {
+	switch (status) {
+	case SCROBBLER_STATUS_OK:
+	case SCROBBLER_STATUS_ERR_TRACKINF:
+		return false;
+	case SCROBBLER_STATUS_ERR_SCROBAPI:
+		switch (sbs->errornum) {
+		case SCROBBLER_API_ERR_OPERATION_FAILED:
+		case SCROBBLER_API_ERR_SERVICE_OFFLINE:
+		case SCROBBLER_API_ERR_SERVICE_UNAVAILABLE:
+		case SCROBBLER_API_ERR_LIMIT_EXCEDED:
+			return true;
+		}
+		return false;
+	default:
+		return true;
+	}
+}
+
+/* Tracks collected for the single scrobble request. Records are copied,
+ * because the reader buffer might be moved by subsequent reads. */
+struct cache_batch {
+	struct cmusfm_cache_record *records[SCROBBLER_BATCH_SIZE];
+	scrobbler_trackinfo_t sbt[SCROBBLER_BATCH_SIZE];
+	size_t len;
+};
+
+/* Add the record (in the host endianness) to the batch. Upon error -1 is
+ * returned. */
+static int cache_batch_add(struct cache_batch *b,
+		const struct cmusfm_cache_record *record, size_t record_size) {
+
+	struct cmusfm_cache_record *copy;
+
+	if ((copy = malloc(record_size)) == NULL)
+		return -1;
+
+	memcpy(copy, record, record_size);
+	cache_record_get_trackinfo(copy, &b->sbt[b->len]);
+	b->records[b->len++] = copy;
+
+	return 0;
+}
+
+static void cache_batch_free(struct cache_batch *b) {
+	size_t i;
+	for (i = 0; i < b->len; i++)
+		free(b->records[i]);
+	b->len = 0;
+}
+
+/* Submit all tracks collected in the batch with a single request, and move
+ * the drain offset to the current reader position. Upon the network or
+ * service failure, the offset is not changed and -1 is returned. If the
+ * request has been rejected by the service rate limit, -2 is returned. */
+static int cache_batch_submit(scrobbler_session_t *sbs, struct cache_batch *b,
+		const struct cache_reader *r, long *offset) {
+
+	scrobbler_status_t status = SCROBBLER_STATUS_OK;
+	size_t i;
+
+	if (b->len > 0)
+		status = scrobbler_scrobble_batch(sbs, b->sbt, b->len);
+
+	/* Batch sent without the response is kept in the cache (the failure is
+	 * transient), because we do not know whether it has been delivered. Its
+	 * tracks are marked as pending, so they are reconciled with the service
+	 * before the resubmission. */
+	if (status == SCROBBLER_STATUS_OK)
+		for (i = 0; i < b->len; i++)
+			cmusfm_index_add(&b->sbt[i]);
+	else if (status == SCROBBLER_STATUS_ERR_NORESPONSE)
+		for (i = 0; i < b->len; i++)
+			cmusfm_index_add_pending(&b->sbt[i]);
+	cache_batch_free(b);
+
+	if (!cache_is_transient_failure(sbs, status)) {
+		*offset = r->offset + r->pos;
+		return 0;
+	}
+
+	if (status == SCROBBLER_STATUS_ERR_SCROBAPI &&
+			sbs->errornum == SCROBBLER_API_ERR_LIMIT_EXCEDED)
+		return -2;
+	return -1;
+}
+
+/* Submit up to the given number of tracks saved in the cache file, starting
+ * at the given position, which is updated accordingly. Tracks are sent in
+ * batches of up to SCROBBLER_BATCH_SIZE tracks per request. Expired records
+ * are moved to the archive file without being sent. When all records have
+ * been processed, the cache file is removed and 0 is returned. If there are
+ * more records to submit, 1 is returned. Upon the network or service
+ * failure, the submission is stopped and -1 is returned - it can be resumed
+ * from the updated position. If the submission has been rejected by the
+ * service rate limit, -2 is returned instead - the service is available, so
+ * the drain might be resumed when the rate limiter allows it. If the cache file has been replaced in the
+ * meantime (e.g. compacted), the submission is restarted from the beginning
+ * of the file - already submitted tracks are skipped by the index. */
+int cmusfm_cache_drain(scrobbler_session_t *sbs,
+		struct cmusfm_cache_position *pos, size_t count) {
+
+	struct cache_reader r;
+	struct cache_batch batch = { .len = 0 };
+	scrobbler_trackinfo_t sb_tinf;
+	struct cmusfm_cache_record *record;
+	size_t record_size;
+	size_t submitted = 0;
+	time_t now = time(NULL);
+	struct stat st;
+	long offset;
+	int rv = 1;
+	int err;
+
+	debug("Cache drain: %ld", pos->offset);
+
+	if (cache_reader_open(&r, 0) == -1) {
+		memset(pos, 0, sizeof(*pos));
+		return 0;
+	}
+
+	if (fstat(fileno(r.f), &st) == 0 &&
+			(st.st_dev != pos->dev || st.st_ino != pos->ino)) {
+		if (pos->offset != 0)
+			debug("Cache file replaced: %ld", pos->offset);
+		pos->offset = 0;
+		pos->quarantined = 0;
+		pos->dev = st.st_dev;
+		pos->ino = st.st_ino;
+	}
+
+	/* position of the first record which has not been submitted yet */
+	offset = r.offset = pos->offset;
+	r.quarantined = pos->quarantined;
+	if (fseek(r.f, r.offset, SEEK_SET) == -1) {
+		rv = -1;
+		goto final;
+	}
+
+	while (submitted < count && (record = cache_reader_next(&r)) != NULL) {
+
+		record_size = get_cache_record_size(record);
+		debug("Record size: %zu", record_size);
+
+		if (cache_record_is_expired(record, now)) {
+			debug("Record expired: %u", record->timestamp);
+			/* submit preceding tracks first, so the record is not archived
+			 * again, when the drain is resumed after the failure */
+			if ((err = cache_batch_submit(sbs, &batch, &r, &offset)) != 0) {
+				rv = err;
+				goto final;
 			}
+			cache_record_hton(record);
+			cache_reader_archive(&r, record_size);
+			offset = r.offset + r.pos;
+			continue;
+		}
 
-			debug("Cache: %s - %s (%s) - %d. %s (%ds)",
-					sb_tinf.artist, sb_tinf.album, sb_tinf.album_artist,
-					sb_tinf.track_number, sb_tinf.track, sb_tinf.duration);
+		cache_record_get_trackinfo(record, &sb_tinf);
+
+		debug("Cache: %s - %s (%s) - %d. %s (%ds)",
+				sb_tinf.artist, sb_tinf.album, sb_tinf.album_artist,
+				sb_tinf.track_number, sb_tinf.track, sb_tinf.duration);
+
+		/* Skip already submitted tracks (also tracks sent without the response
+		 * and recorded by the service) and tracks without the required fields,
+		 * which would be rejected along with the whole batch. */
+		if (!cmusfm_index_contains(&sb_tinf) &&
+				!cmusfm_index_reconcile(sbs, &sb_tinf) &&
+				sb_tinf.artist != NULL && sb_tinf.track != NULL &&
+				cache_batch_add(&batch, record, record_size) == -1) {
+			rv = -1;
+			goto final;
+		}
 
-			/* submit tracks to Last.fm */
-			scrobbler_scrobble(sbs, &sb_tinf);
+		/* point to next record */
+		r.pos += record_size;
+		submitted++;
 
-			/* point to next record */
-			record = (struct cmusfm_cache_record *)((char *)record + record_size);
+		if (batch.len == 0)
+			offset = r.offset + r.pos;
+		else if (batch.len == SCROBBLER_BATCH_SIZE &&
+				(err = cache_batch_submit(sbs, &batch, &r, &offset)) != 0) {
+			rv = err;
+			goto final;
 		}
 
-		if ((size_t)((char *)record - rd_buff) != rd_len)
-			/* seek to the beginning of the current record, because it is
-			 * truncated, so we have to read it one more time */
-			fseek(f, ((char *)record - rd_buff) - rd_len, SEEK_CUR);
 	}
 
-return_failure:
+	if ((err = cache_batch_submit(sbs, &batch, &r, &offset)) != 0) {
+		rv = err;
+		goto final;
+	}
+
+	/* all records have been processed */
+	if (submitted < count)
+		rv = 0;
+
+final:
+	cache_batch_free(&batch);
+	if (r.expired > 0)
+		fprintf(stderr, "INFO: Cache: %zu expired tracks moved to %s.expired\n",
+				r.expired, cmusfm_cache_file);
+	pos->offset = offset;
+	pos->quarantined = r.quarantined;
+	cache_reader_close(&r);
+
+	/* Remove the cache file when it has been drained. Damaged data has been
+	 * already moved to the quarantine file. */
+	if (rv == 0) {
+		unlink(cmusfm_cache_file);
+		memset(pos, 0, sizeof(*pos));
+	}
+
+	/* drained records might have made room for the compaction */
+	if (rv >= 0)
+		writer.compact_failed = 0;
+
+	return rv;
+}
+
+/* Submit all tracks saved in the cache file. */
+void cmusfm_cache_submit(scrobbler_session_t *sbs) {
+	struct cmusfm_cache_position pos = { 0 };
+	cmusfm_cache_drain(sbs, &pos, SIZE_MAX);
+}
 
-	fclose(f);
+/* Count valid records in the cache file. */
+static size_t cache_count_records(void) {
+
+	struct cache_reader r;
+	struct cmusfm_cache_record *record;
+	size_t count = 0;
+
+	if (cache_reader_open(&r, 0) == -1)
+		return 0;
+
+	r.dry_run = true;
+	while ((record = cache_reader_next(&r)) != NULL) {
+		r.pos += get_cache_record_size(record);
+		count++;
+	}
+
+	cache_reader_close(&r);
+	return count;
+}
+
+/* Get the number of tracks in the cache file. */
+size_t cmusfm_cache_count(void) {
+	return cache_count_records();
+}
+
+/* Compact the cache file. Expired and damaged records are removed, and if
+ * the cache exceeds the configured quota, the oldest records are removed
+ * as well, so the cache fits in 3/4 of the quota - the compaction is not
+ * repeated upon every subsequent update. The compacted file replaces the
+ * cache file atomically. */
+static void cache_compact(void) {
+
+	const size_t max_size = config.cache_max_size - config.cache_max_size / 4;
+	const size_t max_records = config.cache_max_records - config.cache_max_records / 4;
+
+	struct cache_reader r;
+	struct cmusfm_cache_record *record;
+	size_t *sizes = NULL, *tmp;
+	size_t i, n = 0, skip = 0, total = 0;
+	size_t record_size;
+	time_t now = time(NULL);
+	char *fname = NULL;
+	FILE *f = NULL;
+
+	debug("Cache compaction");
+	/* cleared upon success */
+	writer.compact_failed = now;
+
+	/* The first pass collects sizes of records which shall be kept, so the
+	 * number of the oldest records exceeding the quota can be determined. */
+	if (cache_reader_open(&r, 0) == -1)
+		return;
+	r.dry_run = true;
+	while ((record = cache_reader_next(&r)) != NULL) {
+		r.pos += record_size = get_cache_record_size(record);
+		if (cache_record_is_expired(record, now))
+			continue;
+		if (n % 1024 == 0) {
+			if ((tmp = realloc(sizes, (n + 1024) * sizeof(*sizes))) == NULL)
+				goto fail;
+			sizes = tmp;
+		}
+		sizes[n++] = record_size;
+		total += record_size;
+	}
+
+	/* nothing to remove */
+	if ((long)total == r.offset + (long)r.len &&
+			(config.cache_max_size == 0 || total <= config.cache_max_size) &&
+			(config.cache_max_records == 0 || n <= config.cache_max_records)) {
+		writer.records = n;
+		writer.compact_failed = 0;
+		goto final;
+	}
+
+	while (skip < n &&
+			((config.cache_max_size != 0 && total > max_size) ||
+			 (config.cache_max_records != 0 && n - skip > max_records)))
+		total -= sizes[skip++];
+
+	debug("Cache compaction: %zu of %zu records removed", skip, n);
+
+	cache_reader_close(&r);
+	if (cache_reader_open(&r, 0) == -1)
+		goto fail_open;
+
+	if ((fname = malloc(strlen(cmusfm_cache_file) + sizeof(".tmp"))) == NULL)
+		goto fail;
+	sprintf(fname, "%s.tmp", cmusfm_cache_file);
+	if ((f = fopen(fname, "w")) == NULL)
+		goto fail;
+
+	for (i = 0; (record = cache_reader_next(&r)) != NULL; ) {
+		record_size = get_cache_record_size(record);
+		if (cache_record_is_expired(record, now)) {
+			cache_record_hton(record);
+			cache_reader_archive(&r, record_size);
+			continue;
+		}
+		cache_record_hton(record);
+		/* remove the oldest records exceeding the quota */
+		if (i++ >= skip && fwrite(record, record_size, 1, f) != 1)
+			goto fail;
+		r.pos += record_size;
+	}
 
-	/* Remove the cache file, regardless of the submission status. Note, that
-	 * keeping invalid file will result in an inability to submit tracks later
-	 * - there is no validity check upon cache creation. */
-	unlink(cmusfm_cache_file);
+	if (fflush(f) != 0 ||
+			(config.cache_sync != CMUSFM_CACHE_SYNC_NONE && fdatasync(fileno(f)) == -1))
+		goto fail;
+	if (rename(fname, cmusfm_cache_file) == -1)
+		goto fail;
+
+	if (skip > 0)
+		fprintf(stderr, "INFO: Cache: %zu oldest tracks removed due to the quota\n", skip);
+	writer.compact_failed = 0;
+
+	/* writer will reopen the compacted file, records written so far have
+	 * been already synchronized with the compacted file */
+	writer.pending = 0;
+	cmusfm_cache_close();
+	goto final;
+
+fail:
+	debug("Cache compaction error: %s", strerror(errno));
+	if (f != NULL)
+		unlink(fname);
+final:
+	cache_reader_close(&r);
+fail_open:
+	if (f != NULL)
+		fclose(f);
+	free(fname);
+	free(sizes);
 }
 
 /* Helper function for retrieving cmusfm cache file. */
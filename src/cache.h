@@ -7,7 +7,9 @@
 #ifndef CMUSFM_CACHE_H_
 #define CMUSFM_CACHE_H_
 
+#include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include "libscrobbler2.h"
 
 
@@ -42,9 +44,23 @@ struct __attribute__((__packed__)) cmusfm_cache_record {
 
 };
 
+/* position of the cache drain, which is valid for the given file only */
+struct cmusfm_cache_position {
+	long offset;
+	/* end of the damaged data which has been already quarantined */
+	long quarantined;
+	dev_t dev;
+	ino_t ino;
+};
+
 
 void cmusfm_cache_update(const scrobbler_trackinfo_t *sb_tinf);
+void cmusfm_cache_sync(void);
+void cmusfm_cache_close(void);
+int cmusfm_cache_drain(scrobbler_session_t *sbs,
+		struct cmusfm_cache_position *pos, size_t count);
 void cmusfm_cache_submit(scrobbler_session_t *sbs);
+size_t cmusfm_cache_count(void);
 char *get_cmusfm_cache_file(void);
 
 #endif  /* CMUSFM_CACHE_H_ */
@@ -0,0 +1,159 @@
+/*
+ * cmusfm - client.c
+ * SPDX-FileCopyrightText: 2010-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "server.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cmusfm.h"
+#include "debug.h"
+
+
+/* Check if server instance is running. If yes, this function returns 1,
+ * otherwise 0 is returned. On error -1 is returned and errno is set
+ * appropriately. */
+int cmusfm_server_check(void) {
+
+	struct sockaddr_un saddr = { .sun_family = AF_UNIX };
+	int fd;
+
+	strncpy(saddr.sun_path, cmusfm_socket_file, sizeof(saddr.sun_path) - 1);
+
+	if ((fd = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+
+	/* check if behind the socket there is an active server instance */
+	if (connect(fd, (struct sockaddr *)(&saddr), sizeof(saddr)) == 0) {
+		close(fd);
+		return 1;
+	}
+
+	close(fd);
+	return 0;
+}
+
+/* Get the ID of the player session. Players which share the server (e.g.
+ * cmus instances with different CMUS_HOME) are distinguished by this ID.
+ * If there is no such ID, NULL is returned. */
+static const char *get_cmusfm_session_id(void) {
+
+	const char *id;
+
+	if ((id = getenv("CMUSFM_SESSION")) != NULL)
+		return id;
+	return getenv("CMUS_HOME");
+}
+
+/* Append key-value pair to the message data. Pair which does not fit into
+ * the data buffer is silently dropped. The new data length is returned. */
+static size_t cmusfm_message_append(char *data, size_t size, size_t len,
+		const char *key, const char *value) {
+
+	size_t klen = strlen(key) + 1;
+	size_t vlen = strlen(value) + 1;
+
+	if (len + klen + vlen > size)
+		return len;
+
+	memcpy(&data[len], key, klen);
+	memcpy(&data[len + klen], value, vlen);
+	return len + klen + vlen;
+}
+
+/* Connect to the server and send the given message. On success the socket
+ * is returned, otherwise -1 is returned and errno is set appropriately. */
+static int cmusfm_server_send_message(const struct cmusfm_message *msg) {
+
+	struct sockaddr_un saddr = { .sun_family = AF_UNIX };
+	size_t len = sizeof(*msg) + msg->length;
+	int err, sock;
+
+	/* connect to the communication socket */
+	strncpy(saddr.sun_path, cmusfm_socket_file, sizeof(saddr.sun_path) - 1);
+
+	if ((sock = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+	if (connect(sock, (struct sockaddr *)(&saddr), sizeof(saddr)) == -1)
+		goto fail;
+
+	debug("Message length: %zu", len);
+	if (write(sock, msg, len) != (ssize_t)len)
+		goto fail;
+
+	return sock;
+
+fail:
+	err = errno;
+	close(sock);
+	errno = err;
+	return -1;
+}
+
+/* Send cmus status display program arguments to the server instance. The
+ * arguments (key-value pairs) are forwarded as they are, so this function
+ * does not need the configuration nor performs any parsing. Arguments which
+ * do not fit into the message buffer are silently dropped. */
+int cmusfm_server_send_status(int argc, char *argv[]) {
+
+	char buffer[CMSOCKET_MESSAGE_SIZE];
+	struct cmusfm_message *msg = (struct cmusfm_message *)buffer;
+	char *data = (char *)(msg + 1);
+	size_t size = sizeof(buffer) - sizeof(*msg);
+	const char *session;
+	size_t len = 0;
+	int sock, i;
+
+	debug("Sending status to server");
+
+	if ((session = get_cmusfm_session_id()) != NULL)
+		len = cmusfm_message_append(data, size, len, "session", session);
+	for (i = 0; i + 1 < argc; i += 2)
+		len = cmusfm_message_append(data, size, len, argv[i], argv[i + 1]);
+
+	msg->type = CMMESSAGE_STATUS;
+	msg->length = len;
+	msg->checksum = make_data_hash((unsigned char *)data, len);
+
+	if ((sock = cmusfm_server_send_message(msg)) == -1)
+		return -1;
+	return close(sock);
+}
+
+/* Subscribe for the server events. On success this function returns the
+ * socket from which the events (JSON lines) can be read until the server
+ * closes the connection. On error -1 is returned and errno is set
+ * appropriately. */
+int cmusfm_server_subscribe(void) {
+
+	struct cmusfm_message msg = { .type = CMMESSAGE_SUBSCRIBE };
+
+	debug("Subscribing for server events");
+
+	/* the server processes the message as soon as the header arrives */
+	return cmusfm_server_send_message(&msg);
+}
+
+/* Helper function for retrieving server socket file. The location can be
+ * overridden with the CMUSFM_SOCKET environment variable, so players with
+ * different configuration homes can share one server instance. */
+char *get_cmusfm_socket_file(void) {
+
+	const char *tmp;
+
+	if ((tmp = getenv("CMUSFM_SOCKET")) != NULL)
+		return strdup(tmp);
+	return get_cmus_home_file(SOCKET_FNAME);
+}
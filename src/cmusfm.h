@@ -7,6 +7,10 @@
 #ifndef CMUSFM_CMUSFM_H_
 #define CMUSFM_CMUSFM_H_
 
+#include <regex.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -17,19 +21,26 @@
 #define CONFIG_FNAME "cmusfm.conf"
 #define SOCKET_FNAME "cmusfm.socket"
 #define CACHE_FNAME  "cmusfm.cache"
+#define STATE_FNAME  "cmusfm.state"
+#define INDEX_FNAME  "cmusfm.index"
 
 
 /* time delay (in seconds) between login attempts to the Last.fm
  * scrobbling service after a submit failure */
 #define SERVICE_RETRY_DELAY 60 * 30
 
+/* initial value (offset basis) of the 64-bit FNV-1a hash */
+#define FNV1A_HASH_INIT 0xcbf29ce484222325
+
 
 /* global variable definitions */
 extern unsigned char SC_api_key[16];
 extern unsigned char SC_secret[16];
 extern const char *cmusfm_cache_file;
 extern const char *cmusfm_config_file;
+extern const char *cmusfm_index_file;
 extern const char *cmusfm_socket_file;
+extern const char *cmusfm_state_file;
 extern struct cmusfm_config config;
 
 
@@ -45,6 +56,9 @@ struct cmtrack_info {
 
 	enum cmstatus status;
 
+	/* player session ID (forwarded by the client) */
+	char *session;
+
 	char *file;
 	char *url;
 
@@ -77,14 +91,37 @@ struct format_match {
 	size_t len;
 };
 
+/* compiled file name format */
+struct format_regexp {
+
+	/* placeholder types in order of appearance */
+	enum format_match_type types[FORMAT_MATCH_TYPE_COUNT];
+
+	regex_t regex;
+	bool compiled;
+
+	/* fast-path matcher for simple formats */
+	bool fast;
+	bool extension;
+	char separator[16];
+	size_t separator_len;
+
+};
+
 
 char *get_cmus_home_dir(void);
 char *get_cmus_home_file(const char *file);
 int mkdirp(const char *dir, mode_t mode);
+uint64_t make_fnv1a_hash(uint64_t hash, const void *data, size_t len);
+uint64_t make_fnv1a_hash_str(uint64_t hash, const char *str);
 int make_data_hash(const unsigned char *data, int len);
 #if ENABLE_LIBNOTIFY
 char *get_album_cover_file(const char *location, const char *format);
 #endif
+int compile_format_regexp(struct format_regexp *fmt, const char *format);
+void free_format_regexp(struct format_regexp *fmt);
+int get_format_matches(const struct format_regexp *fmt, const char *str,
+		struct format_match matches[FORMAT_MATCH_TYPE_COUNT + 1]);
 struct format_match *get_regexp_format_matches(const char *str, const char *format);
 struct format_match *get_regexp_match(struct format_match *matches, enum format_match_type type);
 
@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -56,6 +57,25 @@ static bool decode_config_bool(const char *value) {
 	return strcmp(value, "yes") == 0;
 }
 
+static char *encode_config_cache_sync(enum cmusfm_cache_sync value) {
+	switch (value) {
+	case CMUSFM_CACHE_SYNC_NONE:
+		return "none";
+	case CMUSFM_CACHE_SYNC_ALWAYS:
+		return "always";
+	default:
+		return "batch";
+	}
+}
+
+static enum cmusfm_cache_sync decode_config_cache_sync(const char *value) {
+	if (strcmp(value, "none") == 0)
+		return CMUSFM_CACHE_SYNC_NONE;
+	if (strcmp(value, "always") == 0)
+		return CMUSFM_CACHE_SYNC_ALWAYS;
+	return CMUSFM_CACHE_SYNC_BATCH;
+}
+
 /* Read cmusfm configuration from the file. */
 int cmusfm_config_read(const char *fname, struct cmusfm_config *conf) {
 
@@ -77,6 +97,8 @@ int cmusfm_config_read(const char *fname, struct cmusfm_config *conf) {
 	conf->nowplaying_shoutcast = true;
 	conf->submit_localfile = true;
 	conf->submit_shoutcast = true;
+	conf->scrobble_batch_size = 50;
+	conf->cache_sync = CMUSFM_CACHE_SYNC_BATCH;
 
 	if ((f = fopen(fname, "r")) == NULL)
 		return -1;
@@ -108,6 +130,20 @@ int cmusfm_config_read(const char *fname, struct cmusfm_config *conf) {
 			strncpy(conf->service_api_url, get_config_value(line), sizeof(conf->service_api_url) - 1);
 		else if (strncmp(line, CMCONF_SERVICE_AUTH_URL, sizeof(CMCONF_SERVICE_AUTH_URL) - 1) == 0)
 			strncpy(conf->service_auth_url, get_config_value(line), sizeof(conf->service_auth_url) - 1);
+		else if (strncmp(line, CMCONF_SERVER_IDLE_TIMEOUT, sizeof(CMCONF_SERVER_IDLE_TIMEOUT) - 1) == 0)
+			conf->server_idle_timeout = strtoul(get_config_value(line), NULL, 10);
+		else if (strncmp(line, CMCONF_CAPTURE_FILE, sizeof(CMCONF_CAPTURE_FILE) - 1) == 0)
+			strncpy(conf->capture_file, get_config_value(line), sizeof(conf->capture_file) - 1);
+		else if (strncmp(line, CMCONF_SCROBBLE_BATCH_INTERVAL, sizeof(CMCONF_SCROBBLE_BATCH_INTERVAL) - 1) == 0)
+			conf->scrobble_batch_interval = strtoul(get_config_value(line), NULL, 10);
+		else if (strncmp(line, CMCONF_SCROBBLE_BATCH_SIZE, sizeof(CMCONF_SCROBBLE_BATCH_SIZE) - 1) == 0)
+			conf->scrobble_batch_size = strtoul(get_config_value(line), NULL, 10);
+		else if (strncmp(line, CMCONF_CACHE_SYNC, sizeof(CMCONF_CACHE_SYNC) - 1) == 0)
+			conf->cache_sync = decode_config_cache_sync(get_config_value(line));
+		else if (strncmp(line, CMCONF_CACHE_MAX_SIZE, sizeof(CMCONF_CACHE_MAX_SIZE) - 1) == 0)
+			conf->cache_max_size = strtoul(get_config_value(line), NULL, 10);
+		else if (strncmp(line, CMCONF_CACHE_MAX_RECORDS, sizeof(CMCONF_CACHE_MAX_RECORDS) - 1) == 0)
+			conf->cache_max_records = strtoul(get_config_value(line), NULL, 10);
 	}
 
 	return fclose(f);
@@ -151,6 +187,17 @@ int cmusfm_config_write(const char *fname, struct cmusfm_config *conf) {
 	fprintf(f, "\n# scrobbling service\n");
 	fprintf(f, "%s = \"%s\"\n", CMCONF_SERVICE_API_URL, conf->service_api_url);
 	fprintf(f, "%s = \"%s\"\n", CMCONF_SERVICE_AUTH_URL, conf->service_auth_url);
+	fprintf(f, "%s = \"%u\"\n", CMCONF_SCROBBLE_BATCH_INTERVAL, conf->scrobble_batch_interval);
+	fprintf(f, "%s = \"%u\"\n", CMCONF_SCROBBLE_BATCH_SIZE, conf->scrobble_batch_size);
+
+	fprintf(f, "\n# server\n");
+	fprintf(f, "%s = \"%u\"\n", CMCONF_SERVER_IDLE_TIMEOUT, conf->server_idle_timeout);
+	fprintf(f, "%s = \"%s\"\n", CMCONF_CAPTURE_FILE, conf->capture_file);
+
+	fprintf(f, "\n# offline cache\n");
+	fprintf(f, "%s = \"%s\"\n", CMCONF_CACHE_SYNC, encode_config_cache_sync(conf->cache_sync));
+	fprintf(f, "%s = \"%lu\"\n", CMCONF_CACHE_MAX_SIZE, conf->cache_max_size);
+	fprintf(f, "%s = \"%lu\"\n", CMCONF_CACHE_MAX_RECORDS, conf->cache_max_records);
 
 	return fclose(f);
 }
@@ -27,6 +27,24 @@
 #define CMCONF_NOTIFICATION "notification"
 #define CMCONF_SERVICE_API_URL "service-api-url"
 #define CMCONF_SERVICE_AUTH_URL "service-auth-url"
+#define CMCONF_SERVER_IDLE_TIMEOUT "server-idle-timeout"
+#define CMCONF_CAPTURE_FILE "capture-file"
+#define CMCONF_SCROBBLE_BATCH_INTERVAL "scrobble-batch-interval"
+#define CMCONF_SCROBBLE_BATCH_SIZE "scrobble-batch-size"
+#define CMCONF_CACHE_SYNC "cache-sync"
+#define CMCONF_CACHE_MAX_SIZE "cache-max-size"
+#define CMCONF_CACHE_MAX_RECORDS "cache-max-records"
+
+
+/* Durability policy of the offline cache. */
+enum cmusfm_cache_sync {
+	/* leave the data write-back to the operating system */
+	CMUSFM_CACHE_SYNC_NONE = 0,
+	/* synchronize several records at once (group commit) */
+	CMUSFM_CACHE_SYNC_BATCH,
+	/* synchronize every record */
+	CMUSFM_CACHE_SYNC_ALWAYS,
+};
 
 
 struct cmusfm_config {
@@ -53,6 +71,22 @@ struct cmusfm_config {
 	bool notification : 1;
 #endif
 
+	/* server exits after given number of idle seconds (0 - never) */
+	unsigned int server_idle_timeout;
+	/* record received tracks into the given file (empty - disabled) */
+	char capture_file[96];
+
+	/* submit scrobbles in batches every given number of minutes (0 - submit
+	 * immediately), or when the given number of scrobbles is queued */
+	unsigned int scrobble_batch_interval;
+	unsigned int scrobble_batch_size;
+
+	/* offline cache durability policy */
+	enum cmusfm_cache_sync cache_sync;
+	/* offline cache quota in bytes and records (0 - unlimited) */
+	unsigned long cache_max_size;
+	unsigned long cache_max_records;
+
 };
 
 
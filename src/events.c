@@ -0,0 +1,244 @@
+/*
+ * cmusfm - events.c
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "events.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "debug.h"
+#include "loop.h"
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+
+/* Maximal length of the single event line. */
+#define EVENTS_LINE_SIZE 2048
+
+struct subscriber {
+	int fd;
+	/* data which has not been sent yet */
+	size_t len;
+	char buffer[CMUSFM_EVENTS_BUFFER_SIZE];
+};
+
+static struct subscriber subscribers[CMUSFM_EVENTS_MAX_SUBSCRIBERS];
+static size_t subscribers_len = 0;
+
+/* Disconnect the subscriber. */
+static void events_unsubscribe(struct subscriber *s) {
+	debug("Subscriber removed: %d", s->fd);
+	cmusfm_loop_remove_fd(s->fd);
+	close(s->fd);
+	subscribers_len--;
+	if (s != &subscribers[subscribers_len])
+		memcpy(s, &subscribers[subscribers_len], sizeof(*s));
+}
+
+/* Send as much of the pending data as possible without blocking. Upon error
+ * (e.g. the subscriber has disconnected) -1 is returned. */
+static int events_flush(struct subscriber *s) {
+
+	ssize_t rv;
+
+	while (s->len > 0) {
+		if ((rv = send(s->fd, s->buffer, s->len, MSG_NOSIGNAL)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return -1;
+		}
+		memmove(s->buffer, &s->buffer[rv], s->len - rv);
+		s->len -= rv;
+	}
+
+	/* wait for the output readiness only if there is something to send */
+	cmusfm_loop_watch_fd(s->fd, false, s->len > 0);
+	return 0;
+}
+
+/* Subscriber socket callback. Subscribers are not supposed to send any data
+ * (the writing side of the connection is already closed), so the callback
+ * is called either when the output is possible or upon the hang-up. */
+static void events_subscriber_cb(int fd, void *data) {
+
+	struct subscriber *s = NULL;
+	size_t i;
+	(void)data;
+
+	for (i = 0; i < subscribers_len; i++)
+		if (subscribers[i].fd == fd)
+			s = &subscribers[i];
+	if (s == NULL)
+		return;
+
+	/* without the pending data we are called upon the hang-up only */
+	if (s->len == 0 || events_flush(s) == -1)
+		events_unsubscribe(s);
+
+}
+
+/* Register the connected socket as an event subscriber. The ownership of the
+ * file descriptor is taken over, so it will be closed upon the subscriber
+ * removal (or upon error). Upon error -1 is returned. */
+int cmusfm_events_subscribe(int fd) {
+
+	struct subscriber *s;
+
+	if (subscribers_len == CMUSFM_EVENTS_MAX_SUBSCRIBERS) {
+		debug("Too many subscribers");
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &(int){ 1 }, sizeof(int));
+#endif
+
+	if (cmusfm_loop_add_fd(fd, events_subscriber_cb, NULL) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	s = &subscribers[subscribers_len++];
+	s->fd = fd;
+	s->len = 0;
+
+	debug("New subscriber: %d", fd);
+	cmusfm_loop_watch_fd(fd, false, false);
+	return 0;
+}
+
+/* Get the number of connected subscribers. */
+size_t cmusfm_events_subscribers(void) {
+	return subscribers_len;
+}
+
+/* Append the JSON string to the buffer. If the string does not fit into
+ * the buffer, it is truncated (in such case the returned length is greater
+ * than the buffer size). */
+static size_t events_append_string(char *dest, size_t size, size_t len, const char *str) {
+
+	static const char hexchars[] = "0123456789abcdef";
+	const unsigned char *ptr = (const unsigned char *)str;
+	char esc[7] = "\\u00";
+	size_t esc_len;
+
+	for (dest[len] = '"', len++; *ptr != '\0' && len < size; ptr++) {
+		switch (*ptr) {
+		case '"':
+		case '\\':
+			esc[1] = *ptr;
+			esc_len = 2;
+			break;
+		case '\n':
+			esc[1] = 'n';
+			esc_len = 2;
+			break;
+		case '\t':
+			esc[1] = 't';
+			esc_len = 2;
+			break;
+		default:
+			if (*ptr >= 0x20) {
+				dest[len++] = *ptr;
+				continue;
+			}
+			esc[1] = 'u';
+			esc[4] = hexchars[*ptr >> 4];
+			esc[5] = hexchars[*ptr & 0x0f];
+			esc_len = 6;
+		}
+		if (len + esc_len < size)
+			memcpy(&dest[len], esc, esc_len);
+		len += esc_len;
+	}
+
+	if (len < size)
+		dest[len] = '"';
+	return len + 1;
+}
+
+/* Broadcast the event to all subscribers as a single JSON line, e.g.:
+ * {"event": "status", "time": 1444444444, "status": "playing"}. Data which
+ * can not be sent immediately is buffered. Subscriber which has not read
+ * the previously sent data is disconnected, when the buffer overflows, so
+ * the slow consumer can not stall the server. */
+void cmusfm_events_broadcast(const char *event,
+		const struct cmusfm_event_data *data, size_t n) {
+
+	char line[EVENTS_LINE_SIZE];
+	struct subscriber *s;
+	size_t i, len;
+
+	if (subscribers_len == 0)
+		return;
+
+	len = snprintf(line, sizeof(line), "{\"event\": \"%s\", \"time\": %ld",
+			event, (long)time(NULL));
+	for (i = 0; i < n && len < sizeof(line); i++) {
+		if (data[i].type == CMUSFM_EVENT_DATA_TYPE_STRING && data[i].value.s == NULL)
+			continue;
+		len += snprintf(&line[len], sizeof(line) - len, ", \"%s\": ", data[i].name);
+		if (len >= sizeof(line))
+			break;
+		switch (data[i].type) {
+		case CMUSFM_EVENT_DATA_TYPE_STRING:
+			len = events_append_string(line, sizeof(line), len, data[i].value.s);
+			break;
+		case CMUSFM_EVENT_DATA_TYPE_NUMBER:
+			len += snprintf(&line[len], sizeof(line) - len, "%ld", data[i].value.n);
+			break;
+		case CMUSFM_EVENT_DATA_TYPE_BOOLEAN:
+			len += snprintf(&line[len], sizeof(line) - len, "%s",
+					data[i].value.b ? "true" : "false");
+			break;
+		}
+	}
+
+	/* do not send truncated (invalid) JSON object */
+	if (len + 2 >= sizeof(line)) {
+		debug("Event too long: %s", event);
+		return;
+	}
+
+	memcpy(&line[len], "}\n", 2);
+	len += 2;
+
+	/* iterate backwards - subscriber might be removed */
+	for (i = subscribers_len; i > 0; i--) {
+		s = &subscribers[i - 1];
+		if (s->len + len > sizeof(s->buffer)) {
+			debug("Subscriber too slow: %d", s->fd);
+			events_unsubscribe(s);
+			continue;
+		}
+		memcpy(&s->buffer[s->len], line, len);
+		s->len += len;
+		if (events_flush(s) == -1)
+			events_unsubscribe(s);
+	}
+
+}
+
+/* Disconnect all subscribers. Pending data is discarded. */
+void cmusfm_events_free(void) {
+	while (subscribers_len > 0)
+		events_unsubscribe(&subscribers[subscribers_len - 1]);
+}
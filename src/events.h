@@ -0,0 +1,47 @@
+/*
+ * cmusfm - events.h
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CMUSFM_EVENTS_H_
+#define CMUSFM_EVENTS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+/* The maximal number of event subscribers. */
+#define CMUSFM_EVENTS_MAX_SUBSCRIBERS 8
+
+/* Size of the per-subscriber output buffer. Subscriber which does not read
+ * events fast enough to keep the pending data within this buffer is
+ * disconnected. */
+#define CMUSFM_EVENTS_BUFFER_SIZE 16384
+
+enum cmusfm_event_data_type {
+	CMUSFM_EVENT_DATA_TYPE_STRING,
+	CMUSFM_EVENT_DATA_TYPE_NUMBER,
+	CMUSFM_EVENT_DATA_TYPE_BOOLEAN,
+};
+
+/* Data structure for the event object member. */
+struct cmusfm_event_data {
+	const char *name;
+	enum cmusfm_event_data_type type;
+	union {
+		/* NULL string is skipped */
+		const char *s;
+		long n;
+		bool b;
+	} value;
+};
+
+
+int cmusfm_events_subscribe(int fd);
+size_t cmusfm_events_subscribers(void);
+void cmusfm_events_broadcast(const char *event,
+		const struct cmusfm_event_data *data, size_t n);
+void cmusfm_events_free(void);
+
+#endif  /* CMUSFM_EVENTS_H_ */
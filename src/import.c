@@ -0,0 +1,447 @@
+/*
+ * cmusfm - import.c
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "import.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cache.h"
+#include "cmusfm.h"
+#include "debug.h"
+#include "index.h"
+
+
+/* The number of recently imported plays remembered for the sake of the
+ * duplicate detection. It has to be a power of 2. */
+#define IMPORT_DEDUP_SIZE (1 << 16)
+
+enum import_format {
+	IMPORT_FORMAT_TSV = 0,
+	IMPORT_FORMAT_ROCKBOX,
+};
+
+struct import_slot {
+	char *line;
+	size_t size;
+};
+
+struct import_context {
+
+	scrobbler_session_t *sbs;
+
+	/* batch of plays ready for submission */
+	scrobbler_trackinfo_t batch[SCROBBLER_BATCH_SIZE];
+	struct import_slot slots[SCROBBLER_BATCH_SIZE];
+	size_t batch_len;
+
+	/* fingerprints of recently imported plays */
+	uint64_t *fingerprints;
+
+	/* Rockbox log timestamps might be in the local time */
+	bool local_time;
+
+	struct cmusfm_import_stats stats;
+
+};
+
+/* Check whether the given play has been already imported. If not, it is
+ * remembered for the subsequent checks. */
+static bool import_is_duplicate(struct import_context *ctx,
+		const scrobbler_trackinfo_t *sbt) {
+
+	uint64_t hash = FNV1A_HASH_INIT;
+	char timestamp[24];
+	uint64_t *slot;
+
+	snprintf(timestamp, sizeof(timestamp), "%ld", (long)sbt->timestamp);
+	hash = make_fnv1a_hash_str(hash, timestamp);
+	hash = make_fnv1a_hash_str(hash, sbt->artist);
+	hash = make_fnv1a_hash_str(hash, sbt->track);
+
+	slot = &ctx->fingerprints[hash & (IMPORT_DEDUP_SIZE - 1)];
+	if (*slot == hash)
+		return true;
+
+	*slot = hash;
+	return false;
+}
+
+/* Split the given string at the next tab character. Empty fields are
+ * returned as NULL. */
+static char *import_next_field(char **str) {
+
+	char *field = *str;
+	char *tmp;
+
+	if (field == NULL)
+		return NULL;
+
+	if ((tmp = strchr(field, '\t')) != NULL) {
+		*tmp = '\0';
+		*str = tmp + 1;
+	}
+	else
+		*str = NULL;
+
+	return *field != '\0' ? field : NULL;
+}
+
+/* Parse the Rockbox scrobbler log line:
+ *   artist album title track-number duration rating timestamp mb-track-id
+ * Tracks which were skipped (rating "S") are not imported. */
+static int import_parse_rockbox(char *line, scrobbler_trackinfo_t *sbt) {
+
+	char *tmp;
+
+	sbt->artist = import_next_field(&line);
+	sbt->album = import_next_field(&line);
+	sbt->track = import_next_field(&line);
+	if ((tmp = import_next_field(&line)) != NULL)
+		sbt->track_number = atoi(tmp);
+	if ((tmp = import_next_field(&line)) != NULL)
+		sbt->duration = atoi(tmp);
+	if ((tmp = import_next_field(&line)) == NULL || strcmp(tmp, "L") != 0)
+		return -1;
+	if ((tmp = import_next_field(&line)) != NULL)
+		sbt->timestamp = atol(tmp);
+	sbt->mb_track_id = import_next_field(&line);
+
+	return 0;
+}
+
+/* Parse the TSV line:
+ *   timestamp artist track [album [album-artist [duration [track-number [mb-track-id]]]]] */
+static int import_parse_tsv(char *line, scrobbler_trackinfo_t *sbt) {
+
+	char *tmp;
+
+	if ((tmp = import_next_field(&line)) != NULL)
+		sbt->timestamp = atol(tmp);
+	sbt->artist = import_next_field(&line);
+	sbt->track = import_next_field(&line);
+	sbt->album = import_next_field(&line);
+	sbt->album_artist = import_next_field(&line);
+	if ((tmp = import_next_field(&line)) != NULL)
+		sbt->duration = atoi(tmp);
+	if ((tmp = import_next_field(&line)) != NULL)
+		sbt->track_number = atoi(tmp);
+	sbt->mb_track_id = import_next_field(&line);
+
+	return 0;
+}
+
+/* Encode the Unicode code point as UTF-8. */
+static char *import_utf8_encode(char *dest, unsigned long cp) {
+	if (cp < 0x80)
+		*dest++ = cp;
+	else if (cp < 0x800) {
+		*dest++ = 0xC0 | (cp >> 6);
+		*dest++ = 0x80 | (cp & 0x3F);
+	}
+	else if (cp < 0x10000) {
+		*dest++ = 0xE0 | (cp >> 12);
+		*dest++ = 0x80 | ((cp >> 6) & 0x3F);
+		*dest++ = 0x80 | (cp & 0x3F);
+	}
+	else {
+		*dest++ = 0xF0 | (cp >> 18);
+		*dest++ = 0x80 | ((cp >> 12) & 0x3F);
+		*dest++ = 0x80 | ((cp >> 6) & 0x3F);
+		*dest++ = 0x80 | (cp & 0x3F);
+	}
+	return dest;
+}
+
+/* Parse exactly 4 hexadecimal digits of the JSON Unicode escape sequence.
+ * Upon error -1 is returned. */
+static int import_json_hex4(const char *str, unsigned long *cp) {
+
+	char hex[5];
+	size_t i;
+
+	for (i = 0; i < 4; i++)
+		if (!isxdigit((unsigned char)(hex[i] = str[i])))
+			return -1;
+
+	hex[4] = '\0';
+	*cp = strtoul(hex, NULL, 16);
+	return 0;
+}
+
+/* Parse the JSON string in place. On success, pointer to the first character
+ * after the closing quotation mark is returned, otherwise NULL. */
+static char *import_json_string(char *str, char **value) {
+
+	char *dest = str + 1;
+	unsigned long cp, cp2;
+
+	*value = dest;
+	for (str++; *str != '"'; str++) {
+		if (*str == '\0')
+			return NULL;
+		if (*str != '\\') {
+			*dest++ = *str;
+			continue;
+		}
+		switch (*++str) {
+		case 'b':
+			*dest++ = '\b';
+			break;
+		case 'f':
+			*dest++ = '\f';
+			break;
+		case 'n':
+			*dest++ = '\n';
+			break;
+		case 'r':
+			*dest++ = '\r';
+			break;
+		case 't':
+			*dest++ = '\t';
+			break;
+		case 'u':
+			if (import_json_hex4(str + 1, &cp) == -1)
+				return NULL;
+			str += 4;
+			/* low surrogate without the preceding high one */
+			if (cp >= 0xDC00 && cp < 0xE000)
+				return NULL;
+			/* combine UTF-16 surrogate pair */
+			if (cp >= 0xD800 && cp < 0xDC00) {
+				if (strncmp(str + 1, "\\u", 2) != 0 ||
+						import_json_hex4(str + 3, &cp2) == -1 ||
+						cp2 < 0xDC00 || cp2 >= 0xE000)
+					return NULL;
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (cp2 - 0xDC00);
+				str += 6;
+			}
+			dest = import_utf8_encode(dest, cp);
+			break;
+		case '\0':
+			return NULL;
+		default:
+			*dest++ = *str;
+		}
+	}
+
+	*dest = '\0';
+	return str + 1;
+}
+
+/* Parse the JSON line with a flat object, e.g.:
+ *   {"timestamp": 1444444444, "artist": "The Beatles", "track": "Help!"}
+ * Recognized keys: timestamp, artist, track (or title), album, album_artist
+ * (or albumArtist), duration, track_number (or trackNumber) and mbid. */
+static int import_parse_json(char *line, scrobbler_trackinfo_t *sbt) {
+
+	char *key, *value;
+	bool number, last;
+
+	while (isspace((unsigned char)*line))
+		line++;
+	if (*line++ != '{')
+		return -1;
+
+	for (;;) {
+
+		while (isspace((unsigned char)*line) || *line == ',')
+			line++;
+		if (*line == '}')
+			return 0;
+		if (*line != '"' || (line = import_json_string(line, &key)) == NULL)
+			return -1;
+
+		while (isspace((unsigned char)*line))
+			line++;
+		if (*line++ != ':')
+			return -1;
+		while (isspace((unsigned char)*line))
+			line++;
+
+		last = false;
+		if ((number = *line != '"')) {
+			/* number, boolean or null value */
+			value = line;
+			line += strcspn(line, ",} \t");
+			if (*line == '\0')
+				return -1;
+			last = *line == '}';
+			*line++ = '\0';
+		}
+		else if ((line = import_json_string(line, &value)) == NULL)
+			return -1;
+
+		if (strcmp(key, "timestamp") == 0)
+			sbt->timestamp = atol(value);
+		else if (strcmp(key, "duration") == 0)
+			sbt->duration = atoi(value);
+		else if (strcmp(key, "track_number") == 0 || strcmp(key, "trackNumber") == 0)
+			sbt->track_number = atoi(value);
+		else if (number)
+			;  /* other keys require string values */
+		else if (strcmp(key, "artist") == 0)
+			sbt->artist = value;
+		else if (strcmp(key, "track") == 0 || strcmp(key, "title") == 0)
+			sbt->track = value;
+		else if (strcmp(key, "album") == 0)
+			sbt->album = value;
+		else if (strcmp(key, "album_artist") == 0 || strcmp(key, "albumArtist") == 0)
+			sbt->album_artist = value;
+		else if (strcmp(key, "mbid") == 0)
+			sbt->mb_track_id = value;
+
+		if (last)
+			return 0;
+
+	}
+}
+
+/* Submit all plays collected in the batch. Upon failure, plays are stored
+ * in the cache for later submission. This includes the batch which has been
+ * sent, but the response has not been received - it might have not been
+ * delivered, and the resubmission is ignored by the service if it has. */
+static void import_submit(struct import_context *ctx) {
+
+	scrobbler_status_t status;
+	size_t i;
+
+	if (ctx->batch_len == 0)
+		return;
+
+	/* requests are paced by the scrobbler session rate limiter */
+	status = scrobbler_scrobble_batch(ctx->sbs, ctx->batch, ctx->batch_len);
+	if (status == SCROBBLER_STATUS_OK) {
+		for (i = 0; i < ctx->batch_len; i++)
+			cmusfm_index_add(&ctx->batch[i]);
+		ctx->stats.submitted += ctx->batch_len;
+	}
+	else {
+		fprintf(stderr, "ERROR: Submit: %s\n", scrobbler_strerror(ctx->sbs));
+		for (i = 0; i < ctx->batch_len; i++)
+			cmusfm_cache_update(&ctx->batch[i]);
+		ctx->stats.cached += ctx->batch_len;
+	}
+
+	ctx->batch_len = 0;
+}
+
+/* Import plays recorded by other players. Supported formats are: Rockbox
+ * scrobbler log (.scrobbler.log), TSV and JSON lines (see the parse functions
+ * for details). Input is processed line by line, plays are deduplicated and
+ * submitted in batches. Plays older than the service acceptance window are
+ * skipped. Upon error -1 is returned. */
+int cmusfm_import(scrobbler_session_t *sbs, const char *fname,
+		struct cmusfm_import_stats *stats) {
+
+	enum import_format format = IMPORT_FORMAT_TSV;
+	struct import_context *ctx;
+	struct import_slot *slot;
+	scrobbler_trackinfo_t *sbt;
+	time_t now = time(NULL);
+	FILE *f;
+	size_t i;
+	int rv;
+
+	if (stats != NULL)
+		memset(stats, 0, sizeof(*stats));
+
+	if (strcmp(fname, "-") == 0)
+		f = stdin;
+	else if ((f = fopen(fname, "r")) == NULL)
+		return -1;
+
+	if ((ctx = calloc(1, sizeof(*ctx))) == NULL ||
+			(ctx->fingerprints = calloc(IMPORT_DEDUP_SIZE, sizeof(uint64_t))) == NULL) {
+		free(ctx);
+		if (f != stdin)
+			fclose(f);
+		return -1;
+	}
+
+	ctx->sbs = sbs;
+
+	for (;;) {
+
+		slot = &ctx->slots[ctx->batch_len];
+		sbt = &ctx->batch[ctx->batch_len];
+
+		if (getline(&slot->line, &slot->size, f) == -1)
+			break;
+
+		slot->line[strcspn(slot->line, "\r\n")] = '\0';
+		if (slot->line[0] == '\0')
+			continue;
+
+		if (slot->line[0] == '#') {
+			if (strncmp(slot->line, "#AUDIOSCROBBLER/", 16) == 0)
+				format = IMPORT_FORMAT_ROCKBOX;
+			if (strcmp(slot->line, "#TZ/UNKNOWN") == 0)
+				ctx->local_time = true;
+			continue;
+		}
+
+		ctx->stats.read++;
+		memset(sbt, 0, sizeof(*sbt));
+
+		if (slot->line[0] == '{')
+			rv = import_parse_json(slot->line, sbt);
+		else if (format == IMPORT_FORMAT_ROCKBOX)
+			rv = import_parse_rockbox(slot->line, sbt);
+		else
+			rv = import_parse_tsv(slot->line, sbt);
+
+		if (rv == -1 || sbt->artist == NULL || sbt->track == NULL || sbt->timestamp <= 0) {
+			debug("Import: Invalid line: %zu", ctx->stats.read);
+			ctx->stats.invalid++;
+			continue;
+		}
+
+		if (ctx->local_time) {
+			struct tm tm;
+			localtime_r(&sbt->timestamp, &tm);
+			sbt->timestamp -= tm.tm_gmtoff;
+		}
+
+		if (now - sbt->timestamp > SCROBBLER_MAX_AGE) {
+			ctx->stats.expired++;
+			continue;
+		}
+
+		/* skip plays which have been already submitted */
+		if (import_is_duplicate(ctx, sbt) || cmusfm_index_contains(sbt)) {
+			ctx->stats.duplicates++;
+			continue;
+		}
+
+		if (++ctx->batch_len == SCROBBLER_BATCH_SIZE)
+			import_submit(ctx);
+
+	}
+
+	import_submit(ctx);
+
+	if (stats != NULL)
+		memcpy(stats, &ctx->stats, sizeof(*stats));
+
+	rv = ferror(f) ? -1 : 0;
+	if (f != stdin)
+		fclose(f);
+
+	for (i = 0; i < SCROBBLER_BATCH_SIZE; i++)
+		free(ctx->slots[i].line);
+	free(ctx->fingerprints);
+	free(ctx);
+
+	return rv;
+}
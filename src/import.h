@@ -0,0 +1,32 @@
+/*
+ * cmusfm - import.h
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CMUSFM_IMPORT_H_
+#define CMUSFM_IMPORT_H_
+
+#include <stddef.h>
+#include "libscrobbler2.h"
+
+
+/* import summary */
+struct cmusfm_import_stats {
+	/* the number of plays read from the input */
+	size_t read;
+	/* plays which were not recognized */
+	size_t invalid;
+	/* plays older than the service acceptance window */
+	size_t expired;
+	size_t duplicates;
+	size_t submitted;
+	/* plays stored in the cache due to submission failure */
+	size_t cached;
+};
+
+
+int cmusfm_import(scrobbler_session_t *sbs, const char *fname,
+		struct cmusfm_import_stats *stats);
+
+#endif  /* CMUSFM_IMPORT_H_ */
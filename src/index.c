@@ -0,0 +1,202 @@
+/*
+ * cmusfm - index.c
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "index.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "cmusfm.h"
+#include "debug.h"
+
+
+/* The index of submitted plays is memory-mapped, so all processes which
+ * submit plays (the server and the import command) share the same data.
+ * If the index file can not be used, the index is kept in memory. */
+static struct cmusfm_index index_memory;
+static struct cmusfm_index *index_data = NULL;
+
+/* Get the fingerprint of the given play. The fingerprint is never zero,
+ * because such value marks an empty index slot. */
+static uint64_t index_fingerprint(const scrobbler_trackinfo_t *sbt) {
+
+	uint64_t hash = FNV1A_HASH_INIT;
+	char timestamp[24];
+
+	snprintf(timestamp, sizeof(timestamp), "%ld", (long)sbt->timestamp);
+	hash = make_fnv1a_hash_str(hash, timestamp);
+	hash = make_fnv1a_hash_str(hash, sbt->artist);
+	hash = make_fnv1a_hash_str(hash, sbt->track);
+
+	return hash != 0 ? hash : 1;
+}
+
+/* Open (map) the index file. Index with an invalid header is reset. */
+static struct cmusfm_index *index_open(void) {
+
+	struct cmusfm_index *idx;
+	int fd;
+
+	if (index_data != NULL)
+		return index_data;
+
+	if (cmusfm_index_file != NULL &&
+			(fd = open(cmusfm_index_file, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) != -1) {
+		/* allocate the space upfront, so the write to the mapped
+		 * memory will not fail due to the lack of the disk space */
+		if (posix_fallocate(fd, 0, sizeof(*idx)) == 0 &&
+				(idx = mmap(NULL, sizeof(*idx), PROT_READ | PROT_WRITE,
+						MAP_SHARED, fd, 0)) != MAP_FAILED)
+			index_data = idx;
+		close(fd);
+	}
+
+	if (index_data == NULL) {
+		debug("Using in-memory index");
+		index_data = &index_memory;
+	}
+
+	idx = index_data;
+	if (memcmp(idx->signature, "CMix", sizeof(idx->signature)) != 0 ||
+			idx->size != CMUSFM_INDEX_SIZE || idx->pos >= CMUSFM_INDEX_SIZE ||
+			idx->pending_pos >= CMUSFM_INDEX_PENDING_SIZE) {
+		debug("Index reset");
+		memset(idx, 0, sizeof(*idx));
+		memcpy(idx->signature, "CMix", sizeof(idx->signature));
+		idx->size = CMUSFM_INDEX_SIZE;
+	}
+
+	return idx;
+}
+
+/* Check whether the given play has been already submitted. */
+bool cmusfm_index_contains(const scrobbler_trackinfo_t *sbt) {
+
+	const struct cmusfm_index *idx = index_open();
+	uint64_t fingerprint = index_fingerprint(sbt);
+	size_t i;
+
+	/* The index is small enough for the linear scan to be faster than
+	 * the network round trip by several orders of magnitude. */
+	for (i = 0; i < CMUSFM_INDEX_SIZE; i++)
+		if (idx->fingerprints[i] == fingerprint)
+			return true;
+
+	return false;
+}
+
+/* Insert the given play into the index. If the index is full, the oldest
+ * entry is overwritten. */
+static void index_insert(const scrobbler_trackinfo_t *sbt) {
+	struct cmusfm_index *idx = index_open();
+	idx->fingerprints[idx->pos] = index_fingerprint(sbt);
+	idx->pos = (idx->pos + 1) % CMUSFM_INDEX_SIZE;
+}
+
+/* Get the pending slot of the given play. If the play is not pending,
+ * NULL is returned. */
+static uint64_t *index_find_pending(const scrobbler_trackinfo_t *sbt) {
+
+	struct cmusfm_index *idx = index_open();
+	uint64_t fingerprint = index_fingerprint(sbt);
+	size_t i;
+
+	for (i = 0; i < CMUSFM_INDEX_PENDING_SIZE; i++)
+		if (idx->pending[i] == fingerprint)
+			return &idx->pending[i];
+
+	return NULL;
+}
+
+/* Add the given play to the index of submitted plays. */
+void cmusfm_index_add(const scrobbler_trackinfo_t *sbt) {
+	uint64_t *pending;
+	if (!cmusfm_index_contains(sbt))
+		index_insert(sbt);
+	if ((pending = index_find_pending(sbt)) != NULL)
+		*pending = 0;
+}
+
+/* Add the given play to the index of plays sent without the response. Such
+ * play might have been recorded by the service or not, so it has to be
+ * reconciled before the resubmission. */
+void cmusfm_index_add_pending(const scrobbler_trackinfo_t *sbt) {
+	struct cmusfm_index *idx = index_open();
+	if (index_find_pending(sbt) != NULL)
+		return;
+	idx->pending[idx->pending_pos] = index_fingerprint(sbt);
+	idx->pending_pos = (idx->pending_pos + 1) % CMUSFM_INDEX_PENDING_SIZE;
+}
+
+/* Reconcile the given play with the service, if it has been sent without the
+ * response. If the service has recorded the play, it is added to the index
+ * and true is returned - the play shall not be resubmitted. If the service
+ * could not be queried, the play is left pending and false is returned. */
+bool cmusfm_index_reconcile(scrobbler_session_t *sbs,
+		const scrobbler_trackinfo_t *sbt) {
+
+	scrobbler_trackinfo_t tmp = *sbt;
+	uint64_t *pending;
+	bool found;
+
+	if ((pending = index_find_pending(sbt)) == NULL)
+		return false;
+
+	if (scrobbler_find_scrobble(sbs, &tmp, &found) != SCROBBLER_STATUS_OK)
+		return false;
+
+	debug("Pending play reconciled: %ld (found: %d)", (long)sbt->timestamp, found);
+	*pending = 0;
+	if (found)
+		cmusfm_index_add(sbt);
+
+	return found;
+}
+
+/* Release the index. Subsequent calls will reopen it. */
+void cmusfm_index_free(void) {
+	if (index_data != NULL && index_data != &index_memory)
+		munmap(index_data, sizeof(*index_data));
+	index_data = NULL;
+}
+
+/* Scrobble the track unless it has been already submitted. Only tracks
+ * accepted by the service are indexed. Track which has been sent, but the
+ * response has not been received (the request timed out after the whole
+ * request had been sent) might have been processed by the service or not,
+ * so it is marked as pending - the caller shall retry the submission later,
+ * after the play has been reconciled with the service. */
+scrobbler_status_t cmusfm_index_scrobble(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt) {
+
+	scrobbler_status_t status;
+
+	if (cmusfm_index_contains(sbt)) {
+		debug("Already submitted: %ld", (long)sbt->timestamp);
+		return SCROBBLER_STATUS_OK;
+	}
+
+	status = scrobbler_scrobble(sbs, sbt);
+	if (status == SCROBBLER_STATUS_OK)
+		index_insert(sbt);
+	else if (status == SCROBBLER_STATUS_ERR_NORESPONSE)
+		cmusfm_index_add_pending(sbt);
+
+	return status;
+}
+
+/* Helper function for retrieving cmusfm index file. */
+char *get_cmusfm_index_file(void) {
+	return get_cmus_home_file(INDEX_FNAME);
+}
@@ -0,0 +1,53 @@
+/*
+ * cmusfm - index.h
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CMUSFM_INDEX_H_
+#define CMUSFM_INDEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "libscrobbler2.h"
+
+
+/* The number of recently submitted plays remembered by the index. With
+ * the default size, it covers more than the service acceptance window of
+ * a typical listener. */
+#define CMUSFM_INDEX_SIZE 4096
+
+/* The number of plays sent without the response remembered by the index.
+ * It is big enough for the whole scrobble batch. */
+#define CMUSFM_INDEX_PENDING_SIZE 256
+
+/* index file structure */
+struct cmusfm_index {
+
+	/* "CMix" string at the beginning of the file */
+	char signature[4];
+	uint32_t size;
+	/* the next slot to be overwritten */
+	uint32_t pos;
+	/* the next pending slot to be overwritten */
+	uint32_t pending_pos;
+
+	/* fingerprints of submitted plays (ring buffer) */
+	uint64_t fingerprints[CMUSFM_INDEX_SIZE];
+	/* fingerprints of plays sent without the response (ring buffer) */
+	uint64_t pending[CMUSFM_INDEX_PENDING_SIZE];
+
+};
+
+
+bool cmusfm_index_contains(const scrobbler_trackinfo_t *sbt);
+void cmusfm_index_add(const scrobbler_trackinfo_t *sbt);
+void cmusfm_index_add_pending(const scrobbler_trackinfo_t *sbt);
+bool cmusfm_index_reconcile(scrobbler_session_t *sbs,
+		const scrobbler_trackinfo_t *sbt);
+void cmusfm_index_free(void);
+scrobbler_status_t cmusfm_index_scrobble(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt);
+char *get_cmusfm_index_file(void);
+
+#endif  /* CMUSFM_INDEX_H_ */
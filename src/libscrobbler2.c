@@ -7,6 +7,8 @@
 #include "libscrobbler2.h"
 
 #include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +21,17 @@
  * Convenient macro for getting "on the stack" array size. */
 #define ARRAYSIZE(a) (sizeof(a) / sizeof(*(a)))
 
+/**
+ * Request rate limiter parameters. The service allows an average of 5
+ * requests per second (averaged over a 5 minute period). Upon the rate
+ * limit error the request rate is halved, and then it is slowly increased
+ * with every successful request. */
+#define SB_RATE_BURST 5.0
+#define SB_RATE_MAX 5.0
+#define SB_RATE_MIN 0.2
+#define SB_RATE_INCREASE 0.1
+#define SB_RATE_RETRIES 2
+
 /**
  * Type of the request value. */
 enum sb_request_data_type {
@@ -44,6 +57,28 @@ struct sb_response_data {
 	int size;
 };
 
+/**
+ * Characters which are not percent-encoded in the request string - RFC 3986
+ * unreserved characters, the same set as used by the curl_easy_escape(). */
+static const unsigned char sb_unreserved[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
 static char *mem2hex(char *dest, const unsigned char *mem, size_t n);
 
 /* CURL write callback function. */
@@ -70,12 +105,17 @@ static size_t sb_curl_write_callback(char *ptr, size_t size, size_t nmemb,
 	return size;
 }
 
-/* Initialize CURL handler for internal usage. */
-static CURL *sb_curl_init(CURLoption method, struct sb_response_data *response) {
+/* Initialize CURL handler for internal usage. The handler is kept in the
+ * scrobbler session and it is only reset between requests, so the opened
+ * connections, DNS cache and TLS sessions are reused. */
+static CURL *sb_curl_init(scrobbler_session_t *sbs, CURLoption method,
+		struct sb_response_data *response) {
 
 	CURL *curl;
 
-	if ((curl = curl_easy_init()) == NULL)
+	if ((curl = sbs->curl) != NULL)
+		curl_easy_reset(curl);
+	else if ((curl = sbs->curl = curl_easy_init()) == NULL)
 		return NULL;
 
 	/* do not hang "forever" during connection and data transfer */
@@ -106,9 +146,10 @@ static CURL *sb_curl_init(CURLoption method, struct sb_response_data *response)
 	return curl;
 }
 
-/* Cleanup CURL handler and free allocated response buffer. */
+/* Free allocated response buffer. The CURL handler itself is released
+ * together with the scrobbler session. */
 static void sb_curl_cleanup(CURL *curl, struct sb_response_data *response) {
-	curl_easy_cleanup(curl);
+	(void)curl;
 	free(response->data);
 }
 
@@ -145,6 +186,126 @@ static scrobbler_status_t sb_check_response(struct sb_response_data *response,
 	return sbs->status = SCROBBLER_STATUS_OK;
 }
 
+/**
+ * Check whether the whole request body has been sent. If so, the request
+ * might have been processed by the service, even if the response has not
+ * been received. */
+static bool sb_curl_request_sent(CURL *curl) {
+#if LIBCURL_VERSION_NUM >= 0x073700 /* 7.55.0 */
+	curl_off_t sent = 0, length = 0;
+	curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &sent);
+	curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_UPLOAD_T, &length);
+#else
+	double sent = 0, length = 0;
+	curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &sent);
+	curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_UPLOAD, &length);
+#endif
+	return length > 0 && sent >= length;
+}
+
+/**
+ * Refill the session rate limiter bucket. The number of seconds which has
+ * to elapse before the next token is available is returned. */
+static double sb_rate_limit_refill(scrobbler_session_t *sbs) {
+
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - sbs->rate_time.tv_sec) +
+		(now.tv_nsec - sbs->rate_time.tv_nsec) / 1e9;
+
+	sbs->rate_time = now;
+	sbs->rate_tokens += elapsed * sbs->rate;
+	if (sbs->rate_tokens > SB_RATE_BURST)
+		sbs->rate_tokens = SB_RATE_BURST;
+
+	if (sbs->rate_tokens >= 1)
+		return 0;
+	return (1 - sbs->rate_tokens) / sbs->rate;
+}
+
+/**
+ * Take a token from the session rate limiter bucket. If the bucket is empty
+ * and the session is set up for waiting, wait until the next token is
+ * available. Otherwise, the token is borrowed from the bucket and it is up
+ * to the caller to pace requests (see scrobbler_get_rate_limit_delay). */
+static void sb_rate_limit_acquire(scrobbler_session_t *sbs) {
+
+	struct timespec delay;
+	double wait;
+
+	if ((wait = sb_rate_limit_refill(sbs)) > 0 && sbs->rate_wait) {
+		debug("Rate limit delay: %.3f s", wait);
+		delay.tv_sec = wait;
+		delay.tv_nsec = (wait - delay.tv_sec) * 1e9;
+		while (nanosleep(&delay, &delay) == -1 && errno == EINTR)
+			continue;
+		sb_rate_limit_refill(sbs);
+	}
+
+	sbs->rate_tokens -= 1;
+}
+
+/**
+ * Perform the request and check the response. Paced requests are subject
+ * to the session rate limiter, and upon the rate limit error the request
+ * is retried with a reduced request rate (if the session waits for the
+ * rate limiter tokens). */
+static scrobbler_status_t sb_curl_perform(CURL *curl,
+		struct sb_response_data *response, scrobbler_session_t *sbs, bool paced) {
+
+	int retries = SB_RATE_RETRIES;
+
+	for (;;) {
+
+		if (paced)
+			sb_rate_limit_acquire(sbs);
+		sb_check_response(response, curl_easy_perform(curl), sbs);
+
+		if (sbs->status != SCROBBLER_STATUS_ERR_SCROBAPI ||
+				sbs->errornum != SCROBBLER_API_ERR_LIMIT_EXCEDED)
+			break;
+
+		if (sbs->rate_tokens > 0)
+			sbs->rate_tokens = 0;
+		if ((sbs->rate /= 2) < SB_RATE_MIN)
+			sbs->rate = SB_RATE_MIN;
+		debug("Rate limit exceeded: %.2f req/s", sbs->rate);
+
+		if (!paced || !sbs->rate_wait || retries-- == 0)
+			return sbs->status;
+
+		/* reinitialize response buffer */
+		free(response->data);
+		response->data = NULL;
+		response->size = 0;
+
+	}
+
+	/* request timed out while waiting for the response */
+	if (sbs->status == SCROBBLER_STATUS_ERR_CURLPERF &&
+			sbs->errornum == CURLE_OPERATION_TIMEDOUT &&
+			sb_curl_request_sent(curl)) {
+		debug("Request sent, but no response received");
+		return sbs->status = SCROBBLER_STATUS_ERR_NORESPONSE;
+	}
+
+	/* service has accepted the request rate, so try a bit faster */
+	if (sbs->status != SCROBBLER_STATUS_ERR_CURLPERF &&
+			(sbs->rate += SB_RATE_INCREASE) > SB_RATE_MAX)
+		sbs->rate = SB_RATE_MAX;
+
+	return sbs->status;
+}
+
+/**
+ * Compare request data elements by name - qsort() callback. */
+static int sb_request_data_cmp(const void *a, const void *b) {
+	return strcmp(((const struct sb_request_data *)a)->name,
+			((const struct sb_request_data *)b)->name);
+}
+
 /**
  * Generate MD5 signature for API call. */
 static void sb_generate_method_signature(
@@ -154,10 +315,12 @@ static void sb_generate_method_signature(
 		uint8_t sign[MD5_DIGEST_LENGTH]) {
 
 	char secret_hex[16 * 2 + 1];
-	char tmp_str[2048];
-	size_t i, offset;
+	char number[24];
+	MD5_CTX ctx;
+	size_t i;
+
+	MD5_Init(&ctx);
 
-	offset = 0;
 	for (i = 0; i < sb_request_elements; i++) {
 
 		switch (sb_data[i].type) {
@@ -165,51 +328,106 @@ static void sb_generate_method_signature(
 			/* discard zero numeric values */
 			if (sb_data[i].value.n == 0)
 				continue;
-			offset += snprintf(&tmp_str[offset], sizeof(tmp_str) - offset,
-					"%s%lu", sb_data[i].name, sb_data[i].value.n);
+			snprintf(number, sizeof(number), "%lu", sb_data[i].value.n);
+			MD5_Update(&ctx, sb_data[i].name, strlen(sb_data[i].name));
+			MD5_Update(&ctx, number, strlen(number));
 			break;
 		case SB_REQUEST_DATA_TYPE_STRING:
 			/* discard NULL string values */
 			if (sb_data[i].value.s == NULL)
 				continue;
-			offset += snprintf(&tmp_str[offset], sizeof(tmp_str) - offset,
-					"%s%s", sb_data[i].name, sb_data[i].value.s);
+			MD5_Update(&ctx, sb_data[i].name, strlen(sb_data[i].name));
+			MD5_Update(&ctx, sb_data[i].value.s, strlen(sb_data[i].value.s));
 			break;
 		}
 
-		/* check for potential overflow */
-		if (offset > sizeof(tmp_str))
-			break;
+	}
 
+	mem2hex(secret_hex, sbs->secret, 16);
+	MD5_Update(&ctx, secret_hex, strlen(secret_hex));
+	MD5_Final(sign, &ctx);
+
+	debug("Signature elements: %zu", sb_request_elements);
+
+}
+
+/**
+ * Get the buffer size required for the request string. */
+static size_t sb_get_request_string_size(
+		const struct sb_request_data *sb_data,
+		size_t sb_request_elements) {
+
+	size_t i, size = 1;
+
+	for (i = 0; i < sb_request_elements; i++) {
+		size += strlen(sb_data[i].name) + 2;
+		if (sb_data[i].type == SB_REQUEST_DATA_TYPE_NUMBER)
+			size += 20;
+		else if (sb_data[i].value.s != NULL)
+			/* every character might be percent-encoded */
+			size += strlen(sb_data[i].value.s) * 3;
 	}
 
-	if (offset <= sizeof(tmp_str) - sizeof(secret_hex))
-		strcpy(&tmp_str[offset], mem2hex(secret_hex, sbs->secret, 16));
-	MD5((unsigned char *)tmp_str, strlen(tmp_str), sign);
+	return size;
+}
 
-#if DEBUG
-	char *tmp;
-	if ((tmp = strstr(tmp_str, sbs->session_key)) != NULL)
-		memset(tmp, 'x', strlen(sbs->session_key));
-	debug("Signature data: %s", tmp_str);
-#endif
+/**
+ * Percent-encode the string into the dest buffer. The buffer has to be big
+ * enough to hold three times the length of the source string. Runs of the
+ * unreserved characters are copied at once. The encoded string is not NULL
+ * terminated - the pointer to its end is returned. */
+static char *sb_form_encode(char *dest, const char *src) {
+
+	static const char hexchars[] = "0123456789ABCDEF";
+	const unsigned char *s = (const unsigned char *)src;
+	const unsigned char *run;
+
+	for (;;) {
+
+		/* NULL character is not unreserved */
+		for (run = s; sb_unreserved[*s]; s++)
+			continue;
+		memcpy(dest, run, s - run);
+		dest += s - run;
+
+		if (*s == '\0')
+			return dest;
+
+		*(dest++) = '%';
+		*(dest++) = hexchars[*s >> 4];
+		*(dest++) = hexchars[*s & 0x0f];
+		s++;
+
+	}
 
 }
 
 /**
- * Make curl GET/POST request string. */
+ * Get the length of the percent-encoded string. */
+static size_t sb_form_encoded_length(const char *src) {
+	const unsigned char *s = (const unsigned char *)src;
+	size_t len = 0;
+	for (; *s != '\0'; s++)
+		len += sb_unreserved[*s] ? 1 : 3;
+	return len;
+}
+
+/**
+ * Make curl GET/POST request string. String values are percent-encoded
+ * directly into the dest buffer. If the buffer is too small, elements which
+ * do not fit are omitted. */
 static char *sb_make_curl_request_string(
 		const scrobbler_session_t *sbs,
 		const struct sb_request_data *sb_data,
 		size_t sb_request_elements,
 		char *dest,
-		size_t dest_size,
-		CURL *curl) {
+		size_t dest_size) {
 
-	char *escaped_data;
-	size_t i, offset;
+	char *ptr = dest;
+	char *end = dest + dest_size;
+	size_t i, len, value_len;
+	int rv;
 
-	offset = 0;
 	for (i = 0; i < sb_request_elements; i++) {
 
 		switch (sb_data[i].type) {
@@ -217,28 +435,42 @@ static char *sb_make_curl_request_string(
 			/* discard zero numeric values */
 			if (sb_data[i].value.n == 0)
 				continue;
-			offset += snprintf(&dest[offset], dest_size - offset,
-					"%s=%lu&", sb_data[i].name, sb_data[i].value.n);
+			rv = snprintf(ptr, end - ptr, "%s=%lu&", sb_data[i].name, sb_data[i].value.n);
+			if (rv < 0 || rv >= end - ptr) {
+				debug("Request string truncated: %s", sb_data[i].name);
+				goto final;
+			}
+			ptr += rv;
 			break;
 		case SB_REQUEST_DATA_TYPE_STRING:
 			/* discard NULL string values */
 			if (sb_data[i].value.s == NULL)
 				continue;
-			/* escape for string data */
-			escaped_data = curl_easy_escape(curl, sb_data[i].value.s, 0);
-			offset += snprintf(&dest[offset], dest_size - offset,
-					"%s=%s&", sb_data[i].name, escaped_data);
-			curl_free(escaped_data);
+			len = strlen(sb_data[i].name);
+			/* every character might be percent-encoded, however the exact
+			 * length is calculated only if the worst case does not fit */
+			value_len = strlen(sb_data[i].value.s) * 3;
+			if (len + 2 + value_len > (size_t)(end - ptr))
+				value_len = sb_form_encoded_length(sb_data[i].value.s);
+			if (len + 2 + value_len > (size_t)(end - ptr)) {
+				debug("Request string truncated: %s", sb_data[i].name);
+				goto final;
+			}
+			memcpy(ptr, sb_data[i].name, len);
+			ptr += len;
+			*(ptr++) = '=';
+			ptr = sb_form_encode(ptr, sb_data[i].value.s);
+			*(ptr++) = '&';
 			break;
 		}
 
-		/* check for potential overflow */
-		if (offset > dest_size)
-			break;
 	}
 
+final:
 	/* strip '&' from the end of the string */
-	dest[offset - 1] = '\0';
+	if (ptr != dest)
+		ptr--;
+	*ptr = '\0';
 
 #if DEBUG
 	char tmp_str[2048] = {};
@@ -290,7 +522,7 @@ scrobbler_status_t scrobbler_scrobble(scrobbler_session_t *sbs,
 	if (sbt->artist == NULL || sbt->track == NULL || sbt->timestamp == 0)
 		return sbs->status = SCROBBLER_STATUS_ERR_TRACKINF;
 
-	if ((curl = sb_curl_init(CURLOPT_POST, &response)) == NULL)
+	if ((curl = sb_curl_init(sbs, CURLOPT_POST, &response)) == NULL)
 		return sbs->status = SCROBBLER_STATUS_ERR_CURLINIT;
 
 	mem2hex(api_key_hex, sbs->api_key, sizeof(sbs->api_key));
@@ -301,17 +533,130 @@ scrobbler_status_t scrobbler_scrobble(scrobbler_session_t *sbs,
 
 	/* make track.scrobble POST request */
 	sb_make_curl_request_string(sbs, sb_data, ARRAYSIZE(sb_data),
-			post_data, sizeof(post_data), curl);
+			post_data, sizeof(post_data));
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
 	curl_easy_setopt(curl, CURLOPT_URL, sbs->api_url);
 
-	sb_check_response(&response, curl_easy_perform(curl), sbs);
+	sb_curl_perform(curl, &response, sbs, true);
 	debug("Scrobble status: %d", sbs->status);
 
 	sb_curl_cleanup(curl, &response);
 	return sbs->status;
 }
 
+/* Scrobble a batch of tracks. The number of tracks has to be in the range
+ * from 1 to SCROBBLER_BATCH_SIZE. */
+scrobbler_status_t scrobbler_scrobble_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, size_t count) {
+
+	/* request data names of a single track (except the index) */
+	static const char *names[] = { "album", "albumArtist", "artist",
+		"duration", "mbid", "timestamp", "track", "trackNumber" };
+
+	CURL *curl;
+	uint8_t sign[MD5_DIGEST_LENGTH];
+	char api_key_hex[sizeof(sbs->api_key) * 2 + 1];
+	char sign_hex[sizeof(sign) * 2 + 1];
+	char (*sb_names)[24] = NULL;
+	struct sb_request_data *sb_data = NULL;
+	struct sb_response_data response;
+	size_t i, j, n = 0, size;
+	char *post_data = NULL;
+
+	debug("Scrobble batch: %zu", count);
+
+	if (count == 0 || count > SCROBBLER_BATCH_SIZE)
+		return sbs->status = SCROBBLER_STATUS_ERR_TRACKINF;
+	for (i = 0; i < count; i++)
+		if (sbt[i].artist == NULL || sbt[i].track == NULL || sbt[i].timestamp == 0)
+			return sbs->status = SCROBBLER_STATUS_ERR_TRACKINF;
+
+	if ((curl = sb_curl_init(sbs, CURLOPT_POST, &response)) == NULL)
+		return sbs->status = SCROBBLER_STATUS_ERR_CURLINIT;
+
+	sb_names = malloc(count * ARRAYSIZE(names) * sizeof(*sb_names));
+	sb_data = malloc((count * ARRAYSIZE(names) + 4) * sizeof(*sb_data));
+	if (sb_names == NULL || sb_data == NULL) {
+		sbs->status = SCROBBLER_STATUS_ERR_CURLINIT;
+		goto final;
+	}
+
+	mem2hex(api_key_hex, sbs->api_key, sizeof(sbs->api_key));
+
+	for (i = 0; i < count; i++)
+		for (j = 0; j < ARRAYSIZE(names); j++, n++) {
+			snprintf(sb_names[n], sizeof(*sb_names), "%s[%zu]", names[j], i);
+			sb_data[n].name = sb_names[n];
+			sb_data[n].type = SB_REQUEST_DATA_TYPE_STRING;
+			switch (j) {
+			case 0:
+				sb_data[n].value.s = sbt[i].album;
+				break;
+			case 1:
+				sb_data[n].value.s = sbt[i].album_artist;
+				break;
+			case 2:
+				sb_data[n].value.s = sbt[i].artist;
+				break;
+			case 3:
+				sb_data[n].type = SB_REQUEST_DATA_TYPE_NUMBER;
+				sb_data[n].value.n = sbt[i].duration;
+				break;
+			case 4:
+				sb_data[n].value.s = sbt[i].mb_track_id;
+				break;
+			case 5:
+				sb_data[n].type = SB_REQUEST_DATA_TYPE_NUMBER;
+				sb_data[n].value.n = sbt[i].timestamp;
+				break;
+			case 6:
+				sb_data[n].value.s = sbt[i].track;
+				break;
+			case 7:
+				sb_data[n].type = SB_REQUEST_DATA_TYPE_NUMBER;
+				sb_data[n].value.n = sbt[i].track_number;
+				break;
+			}
+		}
+
+	sb_data[n++] = (struct sb_request_data){ "api_key",
+		SB_REQUEST_DATA_TYPE_STRING, { .s = api_key_hex } };
+	sb_data[n++] = (struct sb_request_data){ "method",
+		SB_REQUEST_DATA_TYPE_STRING, { .s = "track.scrobble" } };
+	sb_data[n++] = (struct sb_request_data){ "sk",
+		SB_REQUEST_DATA_TYPE_STRING, { .s = sbs->session_key } };
+
+	/* data in alphabetical order sorted by name field (except api_sig) */
+	qsort(sb_data, n, sizeof(*sb_data), sb_request_data_cmp);
+	sb_data[n++] = (struct sb_request_data){ "api_sig",
+		SB_REQUEST_DATA_TYPE_STRING, { .s = sign_hex } };
+
+	/* make signature for track.scrobble API call */
+	sb_generate_method_signature(sbs, sb_data, n - 1, sign);
+	mem2hex(sign_hex, sign, sizeof(sign));
+
+	size = sb_get_request_string_size(sb_data, n);
+	if ((post_data = malloc(size)) == NULL) {
+		sbs->status = SCROBBLER_STATUS_ERR_CURLINIT;
+		goto final;
+	}
+
+	/* make track.scrobble POST request */
+	sb_make_curl_request_string(sbs, sb_data, n, post_data, size);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
+	curl_easy_setopt(curl, CURLOPT_URL, sbs->api_url);
+
+	sb_curl_perform(curl, &response, sbs, true);
+	debug("Scrobble batch status: %d", sbs->status);
+
+final:
+	sb_curl_cleanup(curl, &response);
+	free(post_data);
+	free(sb_names);
+	free(sb_data);
+	return sbs->status;
+}
+
 /* Notify Last.fm that a user has started listening to a track. This
  * is an engine function (without a check for required arguments). */
 static scrobbler_status_t sb_update_now_playing(scrobbler_session_t *sbs,
@@ -345,7 +690,7 @@ static scrobbler_status_t sb_update_now_playing(scrobbler_session_t *sbs,
 			sbt->artist, sbt->album, sbt->album_artist,
 			sbt->track_number, sbt->track, sbt->duration);
 
-	if ((curl = sb_curl_init(CURLOPT_POST, &response)) == NULL)
+	if ((curl = sb_curl_init(sbs, CURLOPT_POST, &response)) == NULL)
 		return sbs->status = SCROBBLER_STATUS_ERR_CURLINIT;
 
 	mem2hex(api_key_hex, sbs->api_key, sizeof(sbs->api_key));
@@ -356,11 +701,11 @@ static scrobbler_status_t sb_update_now_playing(scrobbler_session_t *sbs,
 
 	/* make track.updateNowPlaying POST request */
 	sb_make_curl_request_string(sbs, sb_data, ARRAYSIZE(sb_data),
-			post_data, sizeof(post_data), curl);
+			post_data, sizeof(post_data));
 	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data);
 	curl_easy_setopt(curl, CURLOPT_URL, sbs->api_url);
 
-	sb_check_response(&response, curl_easy_perform(curl), sbs);
+	sb_curl_perform(curl, &response, sbs, true);
 	debug("Now playing status: %d", sbs->status);
 
 	sb_curl_cleanup(curl, &response);
@@ -391,6 +736,57 @@ scrobbler_status_t scrobbler_test_session_key(scrobbler_session_t *sbs) {
 	return sbs->status;
 }
 
+/* Check whether the given play has been recorded by the service. This
+ * function queries the listening history of the session user for the play
+ * with the exact timestamp of the given track. */
+scrobbler_status_t scrobbler_find_scrobble(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, bool *found) {
+
+	CURL *curl;
+	char api_key_hex[sizeof(sbs->api_key) * 2 + 1];
+	char get_url[1024], uts[32];
+	struct sb_response_data response;
+	size_t len;
+
+	/* data in alphabetical order sorted by name field */
+	const struct sb_request_data sb_data[] = {
+		{ "api_key", SB_REQUEST_DATA_TYPE_STRING, { .s = api_key_hex } },
+		{ "from", SB_REQUEST_DATA_TYPE_NUMBER, { .n = sbt->timestamp - 1 } },
+		{ "limit", SB_REQUEST_DATA_TYPE_NUMBER, { .n = 10 } },
+		{ "method", SB_REQUEST_DATA_TYPE_STRING, { .s = "user.getRecentTracks" } },
+		{ "to", SB_REQUEST_DATA_TYPE_NUMBER, { .n = sbt->timestamp + 1 } },
+		{ "user", SB_REQUEST_DATA_TYPE_STRING, { .s = sbs->user_name } },
+	};
+
+	debug("Find scrobble: %ld", sbt->timestamp);
+	*found = false;
+
+	if (sbs->user_name[0] == '\0' || sbt->timestamp == 0)
+		return sbs->status = SCROBBLER_STATUS_ERR_TRACKINF;
+
+	if ((curl = sb_curl_init(sbs, CURLOPT_HTTPGET, &response)) == NULL)
+		return sbs->status = SCROBBLER_STATUS_ERR_CURLINIT;
+
+	mem2hex(api_key_hex, sbs->api_key, sizeof(sbs->api_key));
+
+	/* make user.getRecentTracks GET request */
+	len = snprintf(get_url, sizeof(get_url), "%s?", sbs->api_url);
+	sb_make_curl_request_string(sbs, sb_data, ARRAYSIZE(sb_data),
+			get_url + len, sizeof(get_url) - len);
+	curl_easy_setopt(curl, CURLOPT_URL, get_url);
+
+	/* The track which is being played (if any) is listed without the date,
+	 * so only the play with the exact timestamp is matched. */
+	if (sb_curl_perform(curl, &response, sbs, true) == SCROBBLER_STATUS_OK) {
+		snprintf(uts, sizeof(uts), "uts=\"%ld\"", (long)sbt->timestamp);
+		*found = strstr(response.data, uts) != NULL;
+	}
+
+	debug("Find scrobble status: %d (found: %d)", sbs->status, *found);
+	sb_curl_cleanup(curl, &response);
+	return sbs->status;
+}
+
 /* Get the session key. */
 const char *scrobbler_get_session_key(scrobbler_session_t *sbs) {
 	return sbs->session_key;
@@ -402,7 +798,33 @@ void scrobbler_set_session_key(scrobbler_session_t *sbs, const char *str) {
 	sbs->session_key[sizeof(sbs->session_key) - 1] = '\0';
 }
 
-/* Perform scrobbler service authentication process. */
+/* Set the name of the session user. */
+void scrobbler_set_user_name(scrobbler_session_t *sbs, const char *str) {
+	strncpy(sbs->user_name, str, sizeof(sbs->user_name) - 1);
+	sbs->user_name[sizeof(sbs->user_name) - 1] = '\0';
+}
+
+/* Get the number of milliseconds which should elapse before the next request
+ * is sent, so the request rate does not exceed the service rate limit. */
+unsigned int scrobbler_get_rate_limit_delay(scrobbler_session_t *sbs) {
+	return sb_rate_limit_refill(sbs) * 1000 + 0.999;
+}
+
+/* Set whether requests shall wait for the rate limiter. By default requests
+ * are sent immediately, and the caller shall pace them on its own. */
+void scrobbler_set_rate_limit_wait(scrobbler_session_t *sbs, bool wait) {
+	sbs->rate_wait = wait;
+}
+
+/* Check whether the last request has been rejected by the service rate limit.
+ * Such request might be retried as soon as the rate limiter allows it. */
+bool scrobbler_is_rate_limited(scrobbler_session_t *sbs) {
+	return sbs->status == SCROBBLER_STATUS_ERR_SCROBAPI &&
+		sbs->errornum == SCROBBLER_API_ERR_LIMIT_EXCEDED;
+}
+
+/* Perform scrobbler service authentication process. Authentication requests
+ * are not paced by the rate limiter, since they are sent interactively. */
 scrobbler_status_t scrobbler_authentication(scrobbler_session_t *sbs,
 		scrobbler_authuser_callback_t callback) {
 
@@ -430,7 +852,7 @@ scrobbler_status_t scrobbler_authentication(scrobbler_session_t *sbs,
 		{ "api_sig", SB_REQUEST_DATA_TYPE_STRING, { .s = sign_hex } },
 	};
 
-	if ((curl = sb_curl_init(CURLOPT_HTTPGET, &response)) == NULL)
+	if ((curl = sb_curl_init(sbs, CURLOPT_HTTPGET, &response)) == NULL)
 		return sbs->status = SCROBBLER_STATUS_ERR_CURLINIT;
 
 	mem2hex(api_key_hex, sbs->api_key, sizeof(sbs->api_key));
@@ -442,10 +864,10 @@ scrobbler_status_t scrobbler_authentication(scrobbler_session_t *sbs,
 	/* make auth.getToken GET request */
 	len = snprintf(get_url, sizeof(get_url), "%s?", sbs->api_url);
 	sb_make_curl_request_string(sbs, sb_data_token, ARRAYSIZE(sb_data_token),
-			get_url + len, sizeof(get_url) - len, curl);
+			get_url + len, sizeof(get_url) - len);
 	curl_easy_setopt(curl, CURLOPT_URL, get_url);
 
-	status = sb_check_response(&response, curl_easy_perform(curl), sbs);
+	status = sb_curl_perform(curl, &response, sbs, false);
 	if (status != SCROBBLER_STATUS_OK) {
 		sb_curl_cleanup(curl, &response);
 		return status;
@@ -472,10 +894,10 @@ scrobbler_status_t scrobbler_authentication(scrobbler_session_t *sbs,
 	/* make auth.getSession GET request */
 	len = snprintf(get_url, sizeof(get_url), "%s?", sbs->api_url);
 	sb_make_curl_request_string(sbs, sb_data_session, ARRAYSIZE(sb_data_session),
-			get_url + len, sizeof(get_url) - len, curl);
+			get_url + len, sizeof(get_url) - len);
 	curl_easy_setopt(curl, CURLOPT_URL, get_url);
 
-	status = sb_check_response(&response, curl_easy_perform(curl), sbs);
+	status = sb_curl_perform(curl, &response, sbs, false);
 	debug("Authentication status: %d", sbs->status);
 	if (status != SCROBBLER_STATUS_OK) {
 		sb_curl_cleanup(curl, &response);
@@ -520,10 +942,16 @@ scrobbler_session_t *scrobbler_initialize(const char *api_url,
 	memcpy(sbs->api_key, api_key, sizeof(sbs->api_key));
 	memcpy(sbs->secret, secret, sizeof(sbs->secret));
 
+	clock_gettime(CLOCK_MONOTONIC, &sbs->rate_time);
+	sbs->rate_tokens = SB_RATE_BURST;
+	sbs->rate = SB_RATE_MAX;
+
 	return sbs;
 }
 
 void scrobbler_free(scrobbler_session_t *sbs) {
+	if (sbs->curl != NULL)
+		curl_easy_cleanup(sbs->curl);
 	curl_global_cleanup();
 	free(sbs);
 }
@@ -537,6 +965,8 @@ const char *scrobbler_strerror(scrobbler_session_t *sbs) {
 		return "CURL initialization failure";
 	case SCROBBLER_STATUS_ERR_CURLPERF:
 		return curl_easy_strerror(sbs->errornum);
+	case SCROBBLER_STATUS_ERR_NORESPONSE:
+		return "No response received";
 	case SCROBBLER_STATUS_ERR_SCROBAPI:
 		switch ((scrobbler_api_error_t)sbs->errornum) {
 		case SCROBBLER_API_ERR_INVALID_SERVICE:
@@ -11,9 +11,19 @@
 #ifndef CMUSFM_LIBSCROBBLER2_H_
 #define CMUSFM_LIBSCROBBLER2_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
+/* The maximum number of tracks which can be scrobbled with a single
+ * request (see scrobbler_scrobble_batch). */
+#define SCROBBLER_BATCH_SIZE 50
+
+/* The maximum age (in seconds) of a scrobble accepted by the service.
+ * Older scrobbles are ignored by the service. */
+#define SCROBBLER_MAX_AGE (14 * 24 * 60 * 60)
+
 /* Status definitions. For more comprehensive information about errors,
  * see the errornum variable in the session structure. */
 typedef enum scrobbler_status {
@@ -22,7 +32,8 @@ typedef enum scrobbler_status {
 	SCROBBLER_STATUS_ERR_CURLPERF,  /* curl perform error - network issue */
 	SCROBBLER_STATUS_ERR_SCROBAPI,  /* scrobbler API error */
 	SCROBBLER_STATUS_ERR_CALLBACK,  /* callback error (authentication) */
-	SCROBBLER_STATUS_ERR_TRACKINF   /* missing required field in trackinfo */
+	SCROBBLER_STATUS_ERR_TRACKINF,  /* missing required field in trackinfo */
+	SCROBBLER_STATUS_ERR_NORESPONSE /* request sent, but no response received */
 } scrobbler_status_t;
 
 /* Possible error codes returned by scrobbler API. */
@@ -73,6 +84,17 @@ typedef struct scrobbler_session {
 	scrobbler_status_t status;
 	uint8_t errornum;
 
+	/* request rate limiter (token bucket) */
+	struct timespec rate_time;
+	double rate_tokens;
+	/* current request rate (per second) */
+	double rate;
+	/* wait for the rate limiter token before sending the request */
+	bool rate_wait;
+
+	/* CURL handler shared by all requests (connection reuse) */
+	void *curl;
+
 } scrobbler_session_t;
 
 typedef struct scrobbler_trackinfo {
@@ -107,10 +129,19 @@ scrobbler_status_t scrobbler_test_session_key(scrobbler_session_t *sbs);
 
 const char *scrobbler_get_session_key(scrobbler_session_t *sbs);
 void scrobbler_set_session_key(scrobbler_session_t *sbs, const char *str);
+void scrobbler_set_user_name(scrobbler_session_t *sbs, const char *str);
+
+unsigned int scrobbler_get_rate_limit_delay(scrobbler_session_t *sbs);
+void scrobbler_set_rate_limit_wait(scrobbler_session_t *sbs, bool wait);
+bool scrobbler_is_rate_limited(scrobbler_session_t *sbs);
 
 scrobbler_status_t scrobbler_update_now_playing(scrobbler_session_t *sbs,
 		scrobbler_trackinfo_t *sbt);
 scrobbler_status_t scrobbler_scrobble(scrobbler_session_t *sbs,
 		scrobbler_trackinfo_t *sbt);
+scrobbler_status_t scrobbler_scrobble_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, size_t count);
+scrobbler_status_t scrobbler_find_scrobble(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, bool *found);
 
 #endif  /* CMUSFM_LIBSCROBBLER2_H_ */
@@ -0,0 +1,377 @@
+/*
+ * cmusfm - loop.c
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+
+/* The maximal number of signals which can be handled by the event loop. */
+#define LOOP_MAX_SIGNALS 8
+
+/* The initial capacity of the file descriptor and timer tables. Tables are
+ * grown on demand, so this is not a limit. */
+#define LOOP_TABLE_SIZE 16
+
+struct loop_fd {
+	int fd;
+	/* poll() events of interest */
+	short events;
+	cmusfm_loop_fd_cb callback;
+	void *data;
+};
+
+struct loop_timer {
+	int id;
+	/* expiration time (in milliseconds) */
+	uint64_t expire;
+	cmusfm_loop_timer_cb callback;
+	void *data;
+};
+
+struct loop_signal {
+	int sig;
+	cmusfm_loop_signal_cb callback;
+	void *data;
+};
+
+/* The event loop is based on the poll() call, which is available on every
+ * supported platform. Timers are kept in a small array, and signals are
+ * delivered to the loop via the self-pipe, so there is no race between
+ * the signal arrival and the poll() call. */
+static struct {
+
+	struct loop_fd *fds;
+	size_t fds_len;
+	size_t fds_size;
+
+	/* poll() descriptors (the self-pipe and registered ones) */
+	struct pollfd *pfds;
+	size_t pfds_size;
+
+	struct loop_timer *timers;
+	size_t timers_len;
+	size_t timers_size;
+	int timers_id;
+
+	struct loop_signal signals[LOOP_MAX_SIGNALS];
+	size_t signals_len;
+	int signals_pipe[2];
+
+	bool running;
+
+} loop = { .signals_pipe = { -1, -1 } };
+
+/* Get the monotonic time in milliseconds. */
+static uint64_t loop_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Signal handler which forwards signal number to the self-pipe. */
+static void loop_signal_handler(int sig) {
+	int errno_ = errno;
+	unsigned char byte = sig;
+	/* If the pipe is full, the loop is going to be woken up anyway. */
+	write(loop.signals_pipe[1], &byte, sizeof(byte));
+	errno = errno_;
+}
+
+/* Grow the table, so it can hold at least one more element. Upon error -1
+ * is returned and the table is left intact. */
+static int loop_table_grow(void *table, size_t *size, size_t len, size_t item_size) {
+
+	size_t new_size = *size != 0 ? *size * 2 : LOOP_TABLE_SIZE;
+	void *tmp;
+
+	if (len < *size)
+		return 0;
+
+	if ((tmp = realloc(*(void **)table, new_size * item_size)) == NULL) {
+		fprintf(stderr, "ERROR: Event loop: %s\n", strerror(errno));
+		return -1;
+	}
+
+	*(void **)table = tmp;
+	*size = new_size;
+	return 0;
+}
+
+/* Initialize the event loop. Tables are allocated with the initial capacity,
+ * so registrations done right after the initialization can not fail. Upon
+ * error -1 is returned. */
+int cmusfm_loop_init(void) {
+
+	int i;
+
+	if (loop_table_grow(&loop.fds, &loop.fds_size, 0, sizeof(*loop.fds)) == -1 ||
+			loop_table_grow(&loop.timers, &loop.timers_size, 0, sizeof(*loop.timers)) == -1) {
+		cmusfm_loop_free();
+		return -1;
+	}
+
+	if (pipe(loop.signals_pipe) == -1) {
+		cmusfm_loop_free();
+		return -1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		fcntl(loop.signals_pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl(loop.signals_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	return 0;
+}
+
+/* Release resources allocated by the event loop. Registered file
+ * descriptors are not closed. */
+void cmusfm_loop_free(void) {
+
+	struct sigaction sigact = { .sa_handler = SIG_DFL };
+	size_t i;
+
+	for (i = 0; i < loop.signals_len; i++)
+		sigaction(loop.signals[i].sig, &sigact, NULL);
+
+	if (loop.signals_pipe[0] != -1) {
+		close(loop.signals_pipe[0]);
+		close(loop.signals_pipe[1]);
+	}
+
+	free(loop.fds);
+	free(loop.pfds);
+	free(loop.timers);
+
+	memset(&loop, 0, sizeof(loop));
+	loop.signals_pipe[0] = loop.signals_pipe[1] = -1;
+}
+
+/* Register file descriptor with the event loop. The callback function is
+ * called when the file descriptor is ready for reading (or when an error
+ * occurred). Upon error -1 is returned. */
+int cmusfm_loop_add_fd(int fd, cmusfm_loop_fd_cb callback, void *data) {
+
+	if (fd == -1 ||
+			loop_table_grow(&loop.fds, &loop.fds_size, loop.fds_len, sizeof(*loop.fds)) == -1)
+		return -1;
+
+	loop.fds[loop.fds_len].fd = fd;
+	loop.fds[loop.fds_len].events = POLLIN;
+	loop.fds[loop.fds_len].callback = callback;
+	loop.fds[loop.fds_len].data = data;
+	loop.fds_len++;
+
+	return 0;
+}
+
+/* Unregister file descriptor from the event loop. */
+void cmusfm_loop_remove_fd(int fd) {
+	size_t i;
+	for (i = 0; i < loop.fds_len; i++)
+		if (loop.fds[i].fd == fd) {
+			memmove(&loop.fds[i], &loop.fds[i + 1],
+					(loop.fds_len - i - 1) * sizeof(*loop.fds));
+			loop.fds_len--;
+			return;
+		}
+}
+
+/* Select readiness conditions watched for the registered file descriptor.
+ * By default, only the input readiness is watched. Note, that errors (and
+ * the hang-up) are reported regardless of the selected conditions. */
+void cmusfm_loop_watch_fd(int fd, bool input, bool output) {
+	size_t i;
+	for (i = 0; i < loop.fds_len; i++)
+		if (loop.fds[i].fd == fd) {
+			loop.fds[i].events = (input ? POLLIN : 0) | (output ? POLLOUT : 0);
+			return;
+		}
+}
+
+/* Register one-shot timer with the event loop. The callback function is
+ * called after the given timeout (in milliseconds). Timer with the zero
+ * timeout is dispatched in the next loop iteration - after pending file
+ * descriptor events. On success the timer ID is returned, otherwise -1. */
+int cmusfm_loop_add_timer(unsigned int timeout, cmusfm_loop_timer_cb callback, void *data) {
+
+	struct loop_timer *timer;
+
+	if (loop_table_grow(&loop.timers, &loop.timers_size, loop.timers_len,
+				sizeof(*loop.timers)) == -1)
+		return -1;
+
+	timer = &loop.timers[loop.timers_len++];
+	timer->id = ++loop.timers_id;
+	timer->expire = loop_time() + timeout;
+	timer->callback = callback;
+	timer->data = data;
+
+	debug("Timer added: %d (%u ms)", timer->id, timeout);
+	return timer->id;
+}
+
+/* Cancel timer with the given ID. */
+void cmusfm_loop_remove_timer(int id) {
+	size_t i;
+	for (i = 0; i < loop.timers_len; i++)
+		if (loop.timers[i].id == id) {
+			loop.timers[i] = loop.timers[--loop.timers_len];
+			return;
+		}
+}
+
+/* Register signal handler with the event loop. The callback function is
+ * called from the loop context, so it is not limited to the async-signal
+ * safe functions. Upon error -1 is returned. */
+int cmusfm_loop_add_signal(int sig, cmusfm_loop_signal_cb callback, void *data) {
+
+	struct sigaction sigact = {
+		.sa_handler = loop_signal_handler,
+		.sa_flags = SA_RESTART };
+
+	if (loop.signals_len == LOOP_MAX_SIGNALS)
+		return -1;
+
+	loop.signals[loop.signals_len].sig = sig;
+	loop.signals[loop.signals_len].callback = callback;
+	loop.signals[loop.signals_len].data = data;
+	loop.signals_len++;
+
+	return sigaction(sig, &sigact, NULL);
+}
+
+/* Dispatch signals forwarded to the self-pipe. */
+static void loop_dispatch_signals(void) {
+
+	unsigned char sigs[16];
+	ssize_t i, len;
+	size_t j;
+
+	while ((len = read(loop.signals_pipe[0], sigs, sizeof(sigs))) > 0)
+		for (i = 0; i < len; i++)
+			for (j = 0; j < loop.signals_len; j++)
+				if (loop.signals[j].sig == sigs[i])
+					loop.signals[j].callback(sigs[i], loop.signals[j].data);
+
+}
+
+/* Dispatch expired timers. Timers added by the callback functions are not
+ * dispatched in the current iteration, even if they have already expired. */
+static void loop_dispatch_timers(void) {
+
+	int last_id = loop.timers_id;
+	uint64_t now = loop_time();
+	struct loop_timer timer;
+	size_t i;
+
+restart:
+	for (i = 0; i < loop.timers_len; i++)
+		if (loop.timers[i].id <= last_id && loop.timers[i].expire <= now) {
+			timer = loop.timers[i];
+			loop.timers[i] = loop.timers[--loop.timers_len];
+			debug("Timer expired: %d", timer.id);
+			timer.callback(timer.data);
+			/* callback might have modified the list */
+			goto restart;
+		}
+
+}
+
+/* Get the poll() timeout for the nearest timer. */
+static int loop_get_timeout(void) {
+
+	uint64_t now, expire = UINT64_MAX;
+	size_t i;
+
+	if (loop.timers_len == 0)
+		return -1;
+
+	for (i = 0; i < loop.timers_len; i++)
+		if (loop.timers[i].expire < expire)
+			expire = loop.timers[i].expire;
+
+	if ((now = loop_time()) >= expire)
+		return 0;
+	if (expire - now > INT_MAX)
+		return INT_MAX;
+	return expire - now;
+}
+
+/* Run the event loop. This function returns when the loop is stopped with
+ * the cmusfm_loop_quit() call. Upon error -1 is returned. */
+int cmusfm_loop_run(void) {
+
+	struct pollfd *pfds;
+	size_t i, j, nfds;
+
+	loop.running = true;
+	while (loop.running) {
+
+		/* The poll() table is resized here only, because file descriptors
+		 * might be registered by callbacks while it is being processed. */
+		while (loop.pfds_size < 1 + loop.fds_len)
+			if (loop_table_grow(&loop.pfds, &loop.pfds_size, loop.pfds_size,
+						sizeof(*loop.pfds)) == -1)
+				return -1;
+
+		pfds = loop.pfds;
+		pfds[0].fd = loop.signals_pipe[0];
+		pfds[0].events = POLLIN;
+		for (i = 0, nfds = 1; i < loop.fds_len; i++, nfds++) {
+			pfds[nfds].fd = loop.fds[i].fd;
+			pfds[nfds].events = loop.fds[i].events;
+		}
+
+		if (poll(pfds, nfds, loop_get_timeout()) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (pfds[0].revents & POLLIN)
+			loop_dispatch_signals();
+
+		for (i = 1; i < nfds && loop.running; i++) {
+			if (pfds[i].revents == 0)
+				continue;
+			/* file descriptor might have been removed by other callback */
+			for (j = 0; j < loop.fds_len; j++)
+				if (loop.fds[j].fd == pfds[i].fd) {
+					loop.fds[j].callback(loop.fds[j].fd, loop.fds[j].data);
+					break;
+				}
+		}
+
+		if (loop.running)
+			loop_dispatch_timers();
+
+	}
+
+	return 0;
+}
+
+/* Stop the event loop. */
+void cmusfm_loop_quit(void) {
+	debug("Stopping event loop");
+	loop.running = false;
+}
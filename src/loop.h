@@ -0,0 +1,31 @@
+/*
+ * cmusfm - loop.h
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CMUSFM_LOOP_H_
+#define CMUSFM_LOOP_H_
+
+#include <stdbool.h>
+
+typedef void (*cmusfm_loop_fd_cb)(int fd, void *data);
+typedef void (*cmusfm_loop_timer_cb)(void *data);
+typedef void (*cmusfm_loop_signal_cb)(int sig, void *data);
+
+int cmusfm_loop_init(void);
+void cmusfm_loop_free(void);
+
+int cmusfm_loop_add_fd(int fd, cmusfm_loop_fd_cb callback, void *data);
+void cmusfm_loop_remove_fd(int fd);
+void cmusfm_loop_watch_fd(int fd, bool input, bool output);
+
+int cmusfm_loop_add_timer(unsigned int timeout, cmusfm_loop_timer_cb callback, void *data);
+void cmusfm_loop_remove_timer(int id);
+
+int cmusfm_loop_add_signal(int sig, cmusfm_loop_signal_cb callback, void *data);
+
+int cmusfm_loop_run(void);
+void cmusfm_loop_quit(void);
+
+#endif  /* CMUSFM_LOOP_H_ */
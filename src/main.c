@@ -15,228 +15,177 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
-#include "cache.h"
-#include "config.h"
-#include "debug.h"
 #include "server.h"
+#include "status.h"
 
 
-/* Last.fm API key for cmusfm */
-unsigned char SC_api_key[16] = {0x67, 0x08, 0x2e, 0x45, 0xda, 0xb1,
-		0xf6, 0x43, 0x3d, 0xa7, 0x2a, 0x00, 0xe3, 0xbc, 0x03, 0x7a};
-unsigned char SC_secret[16] = {0x02, 0xfc, 0xbc, 0x90, 0x34, 0x1a,
-		0x01, 0xf2, 0x1c, 0x3b, 0xfc, 0x05, 0xb6, 0x36, 0xe3, 0xae};
+/* Location of the server program, which handles everything except the
+ * forwarding of the cmus status to the running server instance. */
+#define CMUSFM_SERVER_PROGRAM PKGLIBEXECDIR "/cmusfm-server"
 
 /* Global cmusfm file location variables */
-const char *cmusfm_cache_file = NULL;
-const char *cmusfm_config_file = NULL;
 const char *cmusfm_socket_file = NULL;
 
-/* Global configuration structure */
-struct cmusfm_config config;
-
 /* Access global environment variables */
 extern char **environ;
 
-/* Parse status arguments which we've get from the cmus and return track info
- * structure. Upon error NULL is returned and errno is set appropriately. */
-static struct cmtrack_info *get_track_info(int argc, char *argv[]) {
+/* Print the given number of seconds in the "m:ss" format. */
+static void print_duration(long seconds) {
+	printf("%ld:%02ld", seconds / 60, seconds % 60);
+}
 
-	struct cmtrack_info *tinfo;
-	int i;
+/* Print the status published by the server with the given format. Status
+ * is printed in a single line, so it can be used by status bar widgets. If
+ * the format is NULL, the default one is used. */
+static int cmusfm_show_status(const char *format) {
 
-	if ((tinfo = calloc(1, sizeof(*tinfo))) == NULL)
-		return NULL;
+	static const char *statuses[] = { "unknown", "playing", "paused", "stopped" };
+	const struct cmusfm_status *board;
+	struct cmusfm_status status;
+	long position;
 
-	tinfo->status = CMSTATUS_UNDEFINED;
+	if ((board = cmusfm_status_attach()) == NULL ||
+			cmusfm_status_load(board, &status) == -1 ||
+			!cmusfm_status_is_live(&status))
+		return EXIT_FAILURE;
 
-	for (i = 1; i + 1 < argc; i += 2) {
-		debug("Received argument: %s: %s", argv[i], argv[i + 1]);
-		if (strcmp(argv[i], "status") == 0) {
-			if (strcmp(argv[i + 1], "playing") == 0)
-				tinfo->status = CMSTATUS_PLAYING;
-			else if (strcmp(argv[i + 1], "paused") == 0)
-				tinfo->status = CMSTATUS_PAUSED;
-			else if (strcmp(argv[i + 1], "stopped") == 0)
-				tinfo->status = CMSTATUS_STOPPED;
-		}
-		else if (strcmp(argv[i], "file") == 0)
-			tinfo->file = argv[i + 1];
-		else if (strcmp(argv[i], "url") == 0)
-			tinfo->url = argv[i + 1];
-		/* ID3 metadata exposed by cmus */
-		else if (strcmp(argv[i], "artist") == 0)
-			tinfo->artist = argv[i + 1];
-		else if (strcmp(argv[i], "albumartist") == 0)
-			tinfo->album_artist = argv[i + 1];
-		else if (strcmp(argv[i], "album") == 0)
-			tinfo->album = argv[i + 1];
-		else if (strcmp(argv[i], "discnumber") == 0)
-			tinfo->disc_number = atoi(argv[i + 1]);
-		else if (strcmp(argv[i], "tracknumber") == 0)
-			tinfo->track_number = atoi(argv[i + 1]);
-		else if (strcmp(argv[i], "title") == 0)
-			tinfo->title = argv[i + 1];
-		else if (strcmp(argv[i], "musicbrainz_trackid") == 0)
-			tinfo->mb_track_id = argv[i + 1];
-		else if (strcmp(argv[i], "date") == 0)
-			tinfo->date = argv[i + 1];
-		else if (strcmp(argv[i], "duration") == 0)
-			tinfo->duration = atoi(argv[i + 1]);
-	}
+	if (format == NULL)
+		format = status.status == CMSTATUS_STOPPED ? "%s" : "%s: %a - %t";
 
-	/* NOTE: cmus always passes status parameter */
-	if (tinfo->status == CMSTATUS_UNDEFINED) {
-		free(tinfo);
-		errno = EINVAL;
-		return NULL;
+	position = status.playtime;
+	if (status.status == CMSTATUS_PLAYING)
+		position += time(NULL) - status.unpaused;
+
+	for (; *format != '\0'; format++) {
+		if (*format != '%' || format[1] == '\0') {
+			putchar(*format);
+			continue;
+		}
+		switch (*++format) {
+		case 'a':
+			fputs(status.artist, stdout);
+			break;
+		case 'b':
+			fputs(status.album, stdout);
+			break;
+		case 't':
+			fputs(status.title, stdout);
+			break;
+		case 's':
+			fputs(statuses[status.status <= CMSTATUS_STOPPED ? status.status : 0], stdout);
+			break;
+		case 'p':
+			print_duration(position);
+			break;
+		case 'd':
+			print_duration(status.duration);
+			break;
+		case 'e':
+			if (status.submit_playtime == 0)
+				fputs("no", stdout);
+			else if (position >= status.submit_playtime)
+				fputs("yes", stdout);
+			else
+				print_duration(status.submit_playtime - position);
+			break;
+		case 'q':
+			printf("%u", status.queue);
+			break;
+		case 'o':
+			fputs(status.online ? "online" : "offline", stdout);
+			break;
+		default:
+			putchar(*format);
+		}
 	}
 
-	return tinfo;
+	putchar('\n');
+	return EXIT_SUCCESS;
 }
 
-/* User authorization callback for the initialization process. */
-static int user_authorization(const char *url) {
+/* Print events broadcast by the server until the server closes the
+ * connection (e.g. upon the server exit). */
+static int cmusfm_print_events(void) {
 
-	printf("Grant access to your Last.fm account using the link below,"
-			" then press ENTER:\n  %s\n", url);
+	char buffer[4096];
+	ssize_t len;
+	int sock;
 
-#ifdef __APPLE__
-	char *cmd = "open";
-	char * const argv[] = { cmd, (char *)url, NULL };
-#else
-	char *cmd = "x-www-browser";
-	char * const argv[] = { cmd, (char *)url, NULL };
-#endif
-
-	pid_t pid;
-	int status;
-
-	/* spawn "open" command and forget */
-	if (posix_spawnp(&pid, cmd, NULL, NULL, argv, environ) == 0)
-		waitpid(pid, &status, WNOHANG);
-
-	getchar();
-
-	return 0;
-}
-
-/* Initialization routine. Get Last.fm session key from the scrobbler service
- * and initialize configuration file with default values (if needed). */
-static void cmusfm_initialization(void) {
-
-	scrobbler_session_t *sbs;
-	struct cmusfm_config conf;
-	bool check_prev_session;
-	bool fetch_new_session;
-	char yesno[8], *ptr;
-
-	fetch_new_session = true;
-	check_prev_session = false;
-
-	/* try to make sure that the configuration directory exists */
-	mkdirp(get_cmus_home_dir(), S_IRWXU);
-
-	/* try to read previous configuration */
-	if (cmusfm_config_read(cmusfm_config_file, &conf) == 0)
-		check_prev_session = true;
-
-	if (strlen(conf.user_name) == 0)
-		check_prev_session = false;
-
-	sbs = scrobbler_initialize(conf.service_api_url,
-			conf.service_auth_url, SC_api_key, SC_secret);
-
-	if (check_prev_session) {
-		printf("Checking previous session (user: %s) ...", conf.user_name);
-		fflush(stdout);
-		scrobbler_set_session_key(sbs, conf.session_key);
-		if (scrobbler_test_session_key(sbs) == 0)
-			printf("OK.\n");
-		else
-			printf("failed.\n");
-
-		printf("Fetch new session key [yes/NO]: ");
-		ptr = fgets(yesno, sizeof(yesno), stdin);
-		if (ptr != NULL && strncmp(ptr, "yes", 3) != 0)
-			fetch_new_session = false;
+	if ((sock = cmusfm_server_subscribe()) == -1) {
+		perror("ERROR: Subscribe");
+		return EXIT_FAILURE;
 	}
 
-	if (fetch_new_session) {
-		if (scrobbler_authentication(sbs, user_authorization) == 0) {
-			strncpy(conf.user_name, sbs->user_name, sizeof(conf.user_name));
-			strncpy(conf.session_key, sbs->session_key, sizeof(conf.session_key));
-		}
-		else
-			printf("Error: %s\n", scrobbler_strerror(sbs));
-	}
-	scrobbler_free(sbs);
+	while ((len = read(sock, buffer, sizeof(buffer))) > 0)
+		if (fwrite(buffer, 1, len, stdout) != (size_t)len || fflush(stdout) != 0)
+			break;
 
-	if (cmusfm_config_write(cmusfm_config_file, &conf) != 0)
-		printf("Error: unable to write file: %s\n", cmusfm_config_file);
+	close(sock);
+	return EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[]) {
 
-	struct cmtrack_info *tinfo;
-
 	/* print initialization help message */
 	if (argc == 1) {
-		printf("usage: %s [init]\n\n"
+		printf("usage: %s [init|import <file>|replay <file> [speed]|show [format]|events]\n\n"
 "NOTE: Before usage with the cmus you should invoke this program with the\n"
 "      `init` argument. Afterwards you can set the status_display_program\n"
 "      (for more information see `man cmus`). Enjoy!\n", argv[0]);
 		return EXIT_SUCCESS;
 	}
 
+	/* initialization, server, import and replay commands are handled by the
+	 * server program, which is the only one linked with the scrobbling library */
+	if ((argc == 2 && (strcmp(argv[1], "init") == 0 ||
+					strcmp(argv[1], "server") == 0)) ||
+			(argc == 3 && strcmp(argv[1], "import") == 0) ||
+			((argc == 3 || argc == 4) && strcmp(argv[1], "replay") == 0)) {
+		argv[0] = CMUSFM_SERVER_PROGRAM;
+		execv(argv[0], argv);
+		perror("ERROR: Exec server");
+		return EXIT_FAILURE;
+	}
+
 	/* setup global variables - file locations */
-	cmusfm_cache_file = get_cmusfm_cache_file();
-	cmusfm_config_file = get_cmusfm_config_file();
 	cmusfm_socket_file = get_cmusfm_socket_file();
 
-	if (argc == 2 && strcmp(argv[1], "init") == 0) {
-		cmusfm_initialization();
+	if ((argc == 2 || argc == 3) && strcmp(argv[1], "show") == 0)
+		return cmusfm_show_status(argc == 3 ? argv[2] : NULL);
+	if (argc == 2 && strcmp(argv[1], "events") == 0)
+		return cmusfm_print_events();
+
+	/* Forward cmus status display program arguments to the server. All the
+	 * parsing is done by the server, which holds the configuration. */
+	if (cmusfm_server_send_status(argc - 1, &argv[1]) == 0)
 		return EXIT_SUCCESS;
-	}
 
-	if (cmusfm_config_read(cmusfm_config_file, &config) == -1) {
-		perror("ERROR: Read config");
+	if (errno != ENOENT && errno != ECONNREFUSED) {
+		perror("ERROR: Send status");
 		return EXIT_FAILURE;
 	}
 
-	if (argc == 2 && strcmp(argv[1], "server") == 0)
-		return cmusfm_server_start();
+	char *cmd = CMUSFM_SERVER_PROGRAM;
+	char * const args[] = { cmd, "server", NULL };
+	unsigned int delay = 10;
+	pid_t pid;
 
-	/* try to parse cmus status display program arguments */
-	if ((tinfo = get_track_info(argc, argv)) == NULL) {
-		perror("ERROR: Get track info");
+	if ((errno = posix_spawn(&pid, cmd, NULL, NULL, args, environ)) != 0) {
+		perror("ERROR: Spawn server");
 		return EXIT_FAILURE;
 	}
 
-	if (cmusfm_server_check() == 0) {
+	/* wait for the server to start (up to about 2.5 seconds) */
+	do {
+		usleep(delay * 1000);
+		if (cmusfm_server_send_status(argc - 1, &argv[1]) == 0)
+			return EXIT_SUCCESS;
+	} while ((delay *= 2) <= 1280);
 
-		pid_t pid;
-		if ((pid = fork()) == -1) {
-			perror("ERROR: Fork server");
-			return EXIT_FAILURE;
-		}
-
-		if (pid == 0)
-			return cmusfm_server_start();
-
-		/* wait for the server to start */
-		sleep(1);
-
-	}
-
-	if (cmusfm_server_send_track(tinfo) != 0) {
-		perror("ERROR: Send track");
-		return EXIT_FAILURE;
-	}
-
-	return EXIT_SUCCESS;
+	perror("ERROR: Send status");
+	return EXIT_FAILURE;
 }
@@ -6,35 +6,306 @@
 
 #include "notify.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
+#include <gdk-pixbuf/gdk-pixbuf.h>
 #include <glib.h>
 #include <libnotify/notify.h>
 
+#include "cmusfm.h"
+
 #include "debug.h"
 
 
-/* global notification handler */
+/* Notifications are shown by the worker thread, because every libnotify
+ * call is a synchronous D-Bus round trip, and a slow (or restarting)
+ * notification daemon shall not stall the server. Only the most recent
+ * request is kept in the mailbox, so requests are coalesced when the
+ * worker can not keep up. */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_t thread;
+	bool running;
+	bool quit;
+	/* pending notification request */
+	bool pending;
+	char *summary;
+	char *body;
+	char *icon;
+} mailbox = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* global notification handler - used by the worker thread only */
 static NotifyNotification *cmus_notify;
 
 
-/* Show track information via the notification system. */
-void cmusfm_notify_show(const scrobbler_trackinfo_t *sb_tinf, const char *icon) {
+/* Size (in pixels) of the cover art thumbnail. */
+#define NOTIFY_THUMBNAIL_SIZE 128
+
+/* Time (in seconds) after which an unused thumbnail is removed. */
+#define NOTIFY_THUMBNAIL_MAX_AGE (30 * 24 * 60 * 60)
+
+/* Get the cover art thumbnail directory. Returned value has to be freed. */
+static char *get_thumbnail_dir(void) {
+
+	const char cachedir[] = "/cmusfm";
+	char *fullpath;
+	char *tmp;
+
+	if ((tmp = getenv("XDG_CACHE_HOME")) != NULL) {
+		fullpath = malloc(strlen(tmp) + sizeof(cachedir));
+		sprintf(fullpath, "%s%s", tmp, cachedir);
+		return fullpath;
+	}
+
+	if ((tmp = getenv("HOME")) != NULL) {
+		fullpath = malloc(strlen(tmp) + 7 + sizeof(cachedir));
+		sprintf(fullpath, "%s/.cache%s", tmp, cachedir);
+		return fullpath;
+	}
+
+	return NULL;
+}
+
+/* Remove thumbnails which have not been used for NOTIFY_THUMBNAIL_MAX_AGE
+ * seconds (the modification time of the thumbnail is updated upon every
+ * use), so the cache directory does not grow without bound. Leftovers of
+ * interrupted writes are removed as well. */
+static void notify_prune_thumbnails(const char *dir) {
+
+	time_t threshold = time(NULL) - NOTIFY_THUMBNAIL_MAX_AGE;
+	struct dirent *entry;
+	struct stat st;
+	DIR *d;
+
+	if ((d = opendir(dir)) == NULL)
+		return;
+
+	while ((entry = readdir(d)) != NULL) {
+		/* thumbnail names consist of 16 hex digits and the extension */
+		if (strspn(entry->d_name, "0123456789abcdef") != 16 ||
+				(strcmp(entry->d_name + 16, ".png") != 0 &&
+				 strcmp(entry->d_name + 16, ".png.tmp") != 0))
+			continue;
+		if (fstatat(dirfd(d), entry->d_name, &st, 0) == 0 &&
+				st.st_mtime < threshold) {
+			debug("Removing thumbnail: %s", entry->d_name);
+			unlinkat(dirfd(d), entry->d_name, 0);
+		}
+	}
+
+	closedir(d);
+}
+
+/* Get the notification-sized thumbnail of the given cover art file. Cover
+ * art files are usually much bigger than the notification icon, and the
+ * notification daemon decodes and scales them every time the notification
+ * is shown. Thumbnails are generated once and stored in the cache directory
+ * under the name derived from the cover file path, modification time and
+ * size, so the modified cover gets a new thumbnail. Returned value has to
+ * be freed. Upon error, NULL is returned. */
+static char *notify_get_thumbnail(const char *fname) {
+
+	uint64_t hash = FNV1A_HASH_INIT;
+	GdkPixbuf *pixbuf = NULL;
+	GError *error = NULL;
+	char *dir, *thumbnail = NULL, *tmp = NULL;
+	int width, height;
+	struct stat st;
 
-	/* initialize the notification subsystem if needed */
-	if (!notify_is_initted())
-		cmusfm_notify_initialize();
+	if (stat(fname, &st) == -1)
+		return NULL;
 
+	/* small image does not need a thumbnail */
+	if (gdk_pixbuf_get_file_info(fname, &width, &height) == NULL)
+		return NULL;
+	if (width <= NOTIFY_THUMBNAIL_SIZE && height <= NOTIFY_THUMBNAIL_SIZE)
+		return strdup(fname);
+
+	if ((dir = get_thumbnail_dir()) == NULL)
+		return NULL;
+
+	hash = make_fnv1a_hash(hash, fname, strlen(fname) + 1);
+	hash = make_fnv1a_hash(hash, &st.st_mtime, sizeof(st.st_mtime));
+	hash = make_fnv1a_hash(hash, &st.st_size, sizeof(st.st_size));
+
+	thumbnail = malloc(strlen(dir) + 1 + 16 + 4 + 1);
+	sprintf(thumbnail, "%s/%016" PRIx64 ".png", dir, hash);
+
+	/* mark the thumbnail as recently used */
+	if (utimensat(AT_FDCWD, thumbnail, NULL, 0) == 0)
+		goto final;
+
+	debug("Creating thumbnail: %s", thumbnail);
+
+	if ((pixbuf = gdk_pixbuf_new_from_file_at_scale(fname, NOTIFY_THUMBNAIL_SIZE,
+					NOTIFY_THUMBNAIL_SIZE, TRUE, &error)) == NULL)
+		goto fail;
+
+	mkdirp(dir, 0700);
+
+	/* write to the temporary file first, so the notification daemon will
+	 * never see a partially written thumbnail */
+	tmp = malloc(strlen(thumbnail) + 4 + 1);
+	sprintf(tmp, "%s.tmp", thumbnail);
+	if (!gdk_pixbuf_save(pixbuf, tmp, "png", &error, NULL)) {
+		unlink(tmp);
+		goto fail;
+	}
+	if (rename(tmp, thumbnail) == -1) {
+		debug("Couldn't store thumbnail: %s", strerror(errno));
+		unlink(tmp);
+		goto fail_free;
+	}
+
+	notify_prune_thumbnails(dir);
+	goto final;
+
+fail:
+	debug("Couldn't create thumbnail: %s", error->message);
+	g_error_free(error);
+fail_free:
+	free(thumbnail);
+	thumbnail = NULL;
+final:
+	if (pixbuf != NULL)
+		g_object_unref(pixbuf);
+	free(dir);
+	free(tmp);
+	return thumbnail;
+}
+
+/* Release the notification and disconnect from the notification daemon. */
+static void notify_release(void) {
 	if (cmus_notify) {
-		/* forcefully close previous notification */
-		notify_notification_close(cmus_notify, NULL);
 		g_object_unref(G_OBJECT(cmus_notify));
+		cmus_notify = NULL;
 	}
+	if (notify_is_initted())
+		notify_uninit();
+}
+
+/* Show the notification. The notification object is reused, so the new
+ * notification replaces the previous one. */
+static void notify_send(const char *summary, const char *body, const char *icon) {
 
 	GError *error = NULL;
+
+	/* (re)connect to the notification daemon lazily */
+	if (!notify_is_initted() && !notify_init("cmusfm"))
+		return;
+
+	if (cmus_notify == NULL)
+		cmus_notify = notify_notification_new(summary, body, icon);
+	else
+		notify_notification_update(cmus_notify, summary, body, icon);
+
+	if (!notify_notification_show(cmus_notify, &error)) {
+		debug("Desktop notify error: %s", error->message);
+		g_error_free(error);
+		/* NOTE: Free the notification subsystem upon show failure. This action
+		 *       allows us to recover from the D-Bus connection failure, which
+		 *       might be caused by the notification daemon restart. */
+		notify_release();
+	}
+
+}
+
+/* Clear the pending notification request. The mailbox has to be locked. */
+static void mailbox_clear(void) {
+	free(mailbox.summary);
+	free(mailbox.body);
+	free(mailbox.icon);
+	mailbox.summary = mailbox.body = mailbox.icon = NULL;
+	mailbox.pending = false;
+}
+
+/* Notification worker thread. */
+static void *notify_worker(void *arg) {
+
+	char *summary, *body, *icon, *thumbnail;
+	(void)arg;
+
+	pthread_mutex_lock(&mailbox.mutex);
+	for (;;) {
+
+		while (!mailbox.pending && !mailbox.quit)
+			pthread_cond_wait(&mailbox.cond, &mailbox.mutex);
+		if (mailbox.quit)
+			break;
+
+		/* take over the request, so the mailbox can accept a new one */
+		summary = mailbox.summary;
+		body = mailbox.body;
+		icon = mailbox.icon;
+		mailbox.summary = mailbox.body = mailbox.icon = NULL;
+		mailbox.pending = false;
+
+		pthread_mutex_unlock(&mailbox.mutex);
+		/* fall back to the cover file if thumbnail can not be used */
+		thumbnail = icon != NULL ? notify_get_thumbnail(icon) : NULL;
+		notify_send(summary, body, thumbnail != NULL ? thumbnail : icon);
+		free(summary);
+		free(body);
+		free(icon);
+		free(thumbnail);
+		pthread_mutex_lock(&mailbox.mutex);
+
+	}
+	pthread_mutex_unlock(&mailbox.mutex);
+
+	notify_release();
+	return NULL;
+}
+
+/* Start the worker thread. The mailbox has to be locked. */
+static int notify_start(void) {
+
+	sigset_t sigset, oldset;
+	int rv;
+
+	if (mailbox.running)
+		return 0;
+
+	mailbox.quit = false;
+
+	/* signals shall be handled by the server main loop */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_SETMASK, &sigset, &oldset);
+	rv = pthread_create(&mailbox.thread, NULL, notify_worker, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	if (rv != 0) {
+		debug("Couldn't start notify worker: %s", strerror(rv));
+		return -1;
+	}
+
+	mailbox.running = true;
+	return 0;
+}
+
+/* Show track information via the notification system. This function does
+ * not block - the notification is shown by the worker thread. */
+void cmusfm_notify_show(const scrobbler_trackinfo_t *sb_tinf, const char *icon) {
+
 	const char *track = sb_tinf->track;
-	char *body = NULL;
+	char *summary, *body = NULL;
 
 	const char *artist = "";
 	if (sb_tinf->artist != NULL)
@@ -65,35 +336,56 @@ void cmusfm_notify_show(const scrobbler_trackinfo_t *sb_tinf, const char *icon)
 		if (body == NULL)
 			/* do not display "empty" notification */
 			return;
-		cmus_notify = notify_notification_new(body, NULL, icon);
+		summary = body;
+		body = NULL;
 	}
 	else
-		cmus_notify = notify_notification_new(track, body, icon);
+		summary = strdup(track);
 
-	free(body);
+	pthread_mutex_lock(&mailbox.mutex);
 
-	if (!notify_notification_show(cmus_notify, &error)) {
-		debug("Desktop notify error: %s", error->message);
-		g_error_free(error);
-		/* NOTE: Free the notification subsystem upon show failure. This action
-		 *       allows us to recover from the D-Bus connection failure, which
-		 *       might be caused by the notification daemon restart. */
-		cmusfm_notify_free();
+	if (notify_start() == -1) {
+		pthread_mutex_unlock(&mailbox.mutex);
+		free(summary);
+		free(body);
+		return;
 	}
 
+	/* replace the request which has not been shown yet */
+	mailbox_clear();
+	mailbox.summary = summary;
+	mailbox.body = body;
+	mailbox.icon = icon != NULL ? strdup(icon) : NULL;
+	mailbox.pending = true;
+
+	pthread_cond_signal(&mailbox.cond);
+	pthread_mutex_unlock(&mailbox.mutex);
+
 }
 
-/* Initialize notification system. */
+/* Initialize notification system. The connection with the notification
+ * daemon is established by the worker thread upon the first notification. */
 void cmusfm_notify_initialize() {
-	cmus_notify = NULL;
-	notify_init("cmusfm");
+	pthread_mutex_lock(&mailbox.mutex);
+	notify_start();
+	pthread_mutex_unlock(&mailbox.mutex);
 }
 
-/* Free notification system resources. */
+/* Free notification system resources. Pending notification request is
+ * discarded, however the one which is being shown is completed. */
 void cmusfm_notify_free() {
-	if (cmus_notify) {
-		g_object_unref(G_OBJECT(cmus_notify));
-		cmus_notify = NULL;
+
+	pthread_mutex_lock(&mailbox.mutex);
+	mailbox_clear();
+	if (!mailbox.running) {
+		pthread_mutex_unlock(&mailbox.mutex);
+		return;
 	}
-	notify_uninit();
+	mailbox.quit = true;
+	pthread_cond_signal(&mailbox.cond);
+	pthread_mutex_unlock(&mailbox.mutex);
+
+	pthread_join(mailbox.thread, NULL);
+	mailbox.running = false;
+
 }
@@ -0,0 +1,166 @@
+/*
+ * cmusfm - playstate.c
+ * SPDX-FileCopyrightText: 2010-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "playstate.h"
+
+#include <string.h>
+
+#include "debug.h"
+
+
+/* Initialize the play-state of a new player. */
+void cmusfm_playstate_init(struct cmusfm_playstate *ps) {
+	memset(ps, 0, sizeof(*ps));
+	ps->fulltime = 10;
+}
+
+/* Get the play time required for the current track to be scrobbled. If the
+ * track will not be scrobbled (e.g. it is too short or the submission is
+ * not enabled), 0 is returned. The play time is checked with the rules of
+ * the playstate_submit() function. */
+time_t cmusfm_playstate_get_submit_playtime(const struct cmusfm_playstate *ps,
+		const struct cmusfm_config *conf) {
+
+	const struct cmusfm_data_record *saved = (const struct cmusfm_data_record *)ps->saved_data;
+	time_t playtime = ps->fulltime / 2 + 1;
+
+	if (ps->started == 0 || saved->duration <= 30)
+		return 0;
+	if ((ps->saved_is_radio && !conf->submit_shoutcast) ||
+			(!ps->saved_is_radio && !conf->submit_localfile))
+		return 0;
+
+	return playtime < 241 ? playtime : 241;
+}
+
+/* Get actions announcing the currently played track. */
+static unsigned int playstate_nowplaying(const struct cmusfm_playstate *ps,
+		const struct cmusfm_config *conf, bool online) {
+
+	unsigned int actions = 0;
+
+#if ENABLE_LIBNOTIFY
+	if (conf->notification)
+		actions |= CMUSFM_PLAYSTATE_NOTIFY;
+	else
+		debug("Notification not enabled");
+#endif
+
+	if (online) {
+		if ((ps->saved_is_radio && conf->nowplaying_shoutcast) ||
+				(!ps->saved_is_radio && conf->nowplaying_localfile))
+			actions |= CMUSFM_PLAYSTATE_NOWPLAYING;
+		else
+			debug("Now playing not enabled");
+	}
+
+	return actions;
+}
+
+/* Account the play time of the current track and start tracking the given
+ * record (unless the player has been stopped). */
+static unsigned int playstate_submit(struct cmusfm_playstate *ps,
+		const struct cmusfm_config *conf, const struct cmusfm_data_record *record,
+		time_t now, bool online, struct cmusfm_playstate_submit *submit) {
+
+	const struct cmusfm_data_record *saved = (const struct cmusfm_data_record *)ps->saved_data;
+	unsigned char status = record->status & ~CMSTATUS_SHOUTCASTMASK;
+	unsigned int actions = 0;
+
+	ps->playtime += now - ps->unpaused;
+
+	/* Track should be submitted if it is longer than 30 seconds and it has
+	 * been played for at least half its duration (play time is greater than
+	 * 15 seconds or 50% of the track duration respectively). Also the track
+	 * should be submitted if the play time is greater than 4 minutes. */
+	if (ps->started != 0 && saved->duration > 30 &&
+			(ps->playtime > ps->fulltime - ps->playtime || ps->playtime > 240)) {
+		if ((ps->saved_is_radio && !conf->submit_shoutcast) ||
+				(!ps->saved_is_radio && !conf->submit_localfile))
+			/* skip submission if we don't want it */
+			debug("Submission not enabled");
+		else {
+			memcpy(submit->data, ps->saved_data, sizeof(submit->data));
+			submit->timestamp = ps->started;
+			actions |= online ? CMUSFM_PLAYSTATE_SCROBBLE : CMUSFM_PLAYSTATE_CACHE;
+		}
+	}
+
+	if (status == CMSTATUS_STOPPED) {
+		ps->started = 0;
+		return actions;
+	}
+
+	/* reinitialize variables, save track info for later submission */
+	ps->started = ps->unpaused = now;
+	ps->playtime = ps->paused = 0;
+
+	if ((record->status & CMSTATUS_SHOUTCASTMASK) != 0)
+		/* you have to listen radio min 90s (50% of 180) */
+		ps->fulltime = 180;  /* overrun DEVBYZERO in URL mode :) */
+	else
+		ps->fulltime = record->duration;
+
+	memcpy(ps->saved_data, record, sizeof(ps->saved_data));
+	ps->saved_is_radio = record->status & CMSTATUS_SHOUTCASTMASK;
+
+	if (status == CMSTATUS_PLAYING)
+		actions |= playstate_nowplaying(ps, conf, online);
+
+	return actions;
+}
+
+/* Update the play-state with the given (verified) track record received at
+ * the given time. The online flag tells whether the scrobbling service is
+ * available. This function returns the bitmask of actions which shall be
+ * executed by the caller, where the now-playing related actions refer to
+ * the given record and the scrobble (or cache) action refers to the track
+ * stored in the submit structure. This function has no side effects other
+ * than the play-state update, so it is safe to use with many players. */
+unsigned int cmusfm_playstate_update(struct cmusfm_playstate *ps,
+		const struct cmusfm_config *conf, const struct cmusfm_data_record *record,
+		time_t now, bool online, struct cmusfm_playstate_submit *submit) {
+
+	const struct cmusfm_data_record *saved = (const struct cmusfm_data_record *)ps->saved_data;
+	unsigned char status = record->status & ~CMSTATUS_SHOUTCASTMASK;
+	time_t pausedtime;
+
+	/* User is playing a new track or the status has changed for the previous
+	 * one. In both cases we should check if the track should be submitted. */
+	if (record->checksum2 != saved->checksum2)
+		return playstate_submit(ps, conf, record, now, online, submit);
+
+	switch (status) {
+	case CMSTATUS_STOPPED:
+		return playstate_submit(ps, conf, record, now, online, submit);
+	case CMSTATUS_PAUSED:
+		ps->paused = now;
+		ps->playtime += ps->paused - ps->unpaused;
+		return 0;
+	case CMSTATUS_PLAYING:
+		/* NOTE: There is no possibility to distinguish between replayed track
+		 *       and unpaused. We assumed that if track was paused before, this
+		 *       indicates that track is continued to play (unpaused). In other
+		 *       case track is played again, so we should submit previous play. */
+		if (ps->paused == 0)
+			return playstate_submit(ps, conf, record, now, online, submit);
+		ps->unpaused = now;
+		pausedtime = ps->unpaused - ps->paused;
+		ps->paused = 0;
+		/* If playing was paused for more then 120 seconds, reinitialize
+		 * now playing notification (scrobbler and libnotify). */
+		if (pausedtime > 120)
+			return playstate_nowplaying(ps, conf, online);
+		return 0;
+	default:
+		return 0;
+	}
+
+}
@@ -0,0 +1,51 @@
+/*
+ * cmusfm - playstate.h
+ * SPDX-FileCopyrightText: 2010-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CMUSFM_PLAYSTATE_H_
+#define CMUSFM_PLAYSTATE_H_
+
+#include <stdbool.h>
+#include <time.h>
+#include "config.h"
+#include "server.h"
+
+
+/* Actions requested by the play-state transition. */
+enum cmusfm_playstate_action {
+	/* show the desktop notification for the current track */
+	CMUSFM_PLAYSTATE_NOTIFY = 1 << 0,
+	/* update the now-playing indicator with the current track */
+	CMUSFM_PLAYSTATE_NOWPLAYING = 1 << 1,
+	/* scrobble the previously played track */
+	CMUSFM_PLAYSTATE_SCROBBLE = 1 << 2,
+	/* write the previously played track into the offline cache */
+	CMUSFM_PLAYSTATE_CACHE = 1 << 3,
+};
+
+/* Play-state of the single player. */
+struct cmusfm_playstate {
+	/* record of the currently played track */
+	char saved_data[CMSOCKET_BUFFER_SIZE];
+	char saved_is_radio;
+	time_t started, paused, unpaused;
+	time_t playtime, fulltime;
+};
+
+/* The track which shall be scrobbled (or cached). */
+struct cmusfm_playstate_submit {
+	char data[CMSOCKET_BUFFER_SIZE];
+	time_t timestamp;
+};
+
+
+void cmusfm_playstate_init(struct cmusfm_playstate *ps);
+time_t cmusfm_playstate_get_submit_playtime(const struct cmusfm_playstate *ps,
+		const struct cmusfm_config *conf);
+unsigned int cmusfm_playstate_update(struct cmusfm_playstate *ps,
+		const struct cmusfm_config *conf, const struct cmusfm_data_record *record,
+		time_t now, bool online, struct cmusfm_playstate_submit *submit);
+
+#endif  /* CMUSFM_PLAYSTATE_H_ */
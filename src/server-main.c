@@ -0,0 +1,228 @@
+/*
+ * cmusfm - server-main.c
+ * SPDX-FileCopyrightText: 2010-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "cmusfm.h"
+
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "config.h"
+#include "debug.h"
+#include "import.h"
+#include "index.h"
+#include "server.h"
+
+
+/* Last.fm API key for cmusfm */
+unsigned char SC_api_key[16] = {0x67, 0x08, 0x2e, 0x45, 0xda, 0xb1,
+		0xf6, 0x43, 0x3d, 0xa7, 0x2a, 0x00, 0xe3, 0xbc, 0x03, 0x7a};
+unsigned char SC_secret[16] = {0x02, 0xfc, 0xbc, 0x90, 0x34, 0x1a,
+		0x01, 0xf2, 0x1c, 0x3b, 0xfc, 0x05, 0xb6, 0x36, 0xe3, 0xae};
+
+/* Global cmusfm file location variables */
+const char *cmusfm_cache_file = NULL;
+const char *cmusfm_config_file = NULL;
+const char *cmusfm_index_file = NULL;
+const char *cmusfm_socket_file = NULL;
+const char *cmusfm_state_file = NULL;
+
+/* Global configuration structure */
+struct cmusfm_config config;
+
+/* Access global environment variables */
+extern char **environ;
+
+/* User authorization callback for the initialization process. */
+static int user_authorization(const char *url) {
+
+	printf("Grant access to your Last.fm account using the link below,"
+			" then press ENTER:\n  %s\n", url);
+
+#ifdef __APPLE__
+	char *cmd = "open";
+	char * const argv[] = { cmd, (char *)url, NULL };
+#else
+	char *cmd = "x-www-browser";
+	char * const argv[] = { cmd, (char *)url, NULL };
+#endif
+
+	pid_t pid;
+	int status;
+
+	/* spawn "open" command and forget */
+	if (posix_spawnp(&pid, cmd, NULL, NULL, argv, environ) == 0)
+		waitpid(pid, &status, WNOHANG);
+
+	getchar();
+
+	return 0;
+}
+
+/* Initialization routine. Get Last.fm session key from the scrobbler service
+ * and initialize configuration file with default values (if needed). */
+static void cmusfm_initialization(void) {
+
+	scrobbler_session_t *sbs;
+	struct cmusfm_config conf;
+	bool check_prev_session;
+	bool fetch_new_session;
+	char yesno[8], *ptr;
+
+	fetch_new_session = true;
+	check_prev_session = false;
+
+	/* try to make sure that the configuration directory exists */
+	mkdirp(get_cmus_home_dir(), S_IRWXU);
+
+	/* try to read previous configuration */
+	if (cmusfm_config_read(cmusfm_config_file, &conf) == 0)
+		check_prev_session = true;
+
+	if (strlen(conf.user_name) == 0)
+		check_prev_session = false;
+
+	sbs = scrobbler_initialize(conf.service_api_url,
+			conf.service_auth_url, SC_api_key, SC_secret);
+
+	if (check_prev_session) {
+		printf("Checking previous session (user: %s) ...", conf.user_name);
+		fflush(stdout);
+		scrobbler_set_session_key(sbs, conf.session_key);
+		if (scrobbler_test_session_key(sbs) == 0)
+			printf("OK.\n");
+		else
+			printf("failed.\n");
+
+		printf("Fetch new session key [yes/NO]: ");
+		ptr = fgets(yesno, sizeof(yesno), stdin);
+		if (ptr != NULL && strncmp(ptr, "yes", 3) != 0)
+			fetch_new_session = false;
+	}
+
+	if (fetch_new_session) {
+		if (scrobbler_authentication(sbs, user_authorization) == 0) {
+			strncpy(conf.user_name, sbs->user_name, sizeof(conf.user_name));
+			strncpy(conf.session_key, sbs->session_key, sizeof(conf.session_key));
+		}
+		else
+			printf("Error: %s\n", scrobbler_strerror(sbs));
+	}
+	scrobbler_free(sbs);
+
+	if (cmusfm_config_write(cmusfm_config_file, &conf) != 0)
+		printf("Error: unable to write file: %s\n", cmusfm_config_file);
+}
+
+/* Import plays recorded by other players from the given file. */
+static int cmusfm_import_file(const char *fname) {
+
+	struct cmusfm_import_stats stats;
+	scrobbler_session_t *sbs;
+	int rv;
+
+	sbs = scrobbler_initialize(config.service_api_url,
+			config.service_auth_url, SC_api_key, SC_secret);
+	scrobbler_set_session_key(sbs, config.session_key);
+	scrobbler_set_user_name(sbs, config.user_name);
+	/* import is not interactive, so requests can wait for the rate limiter */
+	scrobbler_set_rate_limit_wait(sbs, true);
+
+	if ((rv = cmusfm_import(sbs, fname, &stats)) == -1)
+		perror("ERROR: Import");
+
+	printf("Read: %zu\n", stats.read);
+	printf("Invalid: %zu\n", stats.invalid);
+	printf("Too old: %zu\n", stats.expired);
+	printf("Duplicates: %zu\n", stats.duplicates);
+	printf("Submitted: %zu\n", stats.submitted);
+	printf("Cached: %zu\n", stats.cached);
+
+	scrobbler_free(sbs);
+	cmusfm_cache_close();
+	cmusfm_index_free();
+	return rv == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Replay track records from the given capture file. */
+static int cmusfm_replay_file(const char *fname, double speed) {
+
+	struct cmusfm_replay_stats stats;
+
+	/* do not overwrite the state of the running server */
+	cmusfm_state_file = NULL;
+
+	if (cmusfm_server_replay(fname, speed, &stats) == -1) {
+		perror("ERROR: Replay");
+		return EXIT_FAILURE;
+	}
+
+	printf("Read: %zu\n", stats.read);
+	printf("Invalid: %zu\n", stats.invalid);
+	printf("Notifications: %zu\n", stats.notifications);
+	printf("Now playing: %zu\n", stats.nowplaying);
+	printf("Scrobbled: %zu\n", stats.scrobbled);
+	printf("Cached: %zu\n", stats.cached);
+	printf("Elapsed: %.3f s (%.0f records/s)\n", stats.elapsed,
+			stats.elapsed > 0 ? stats.read / stats.elapsed : 0);
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[]) {
+
+	bool import = argc > 1 && strcmp(argv[1], "import") == 0;
+	bool replay = argc > 1 && strcmp(argv[1], "replay") == 0;
+
+	if (argc < 2 || (import && argc != 3) || (replay && argc != 3 && argc != 4) ||
+			(!import && !replay && argc != 2)) {
+		printf("usage: %s {init|server|import <file>|replay <file> [speed]}\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	/* setup global variables - file locations */
+	cmusfm_cache_file = get_cmusfm_cache_file();
+	cmusfm_config_file = get_cmusfm_config_file();
+	cmusfm_index_file = get_cmusfm_index_file();
+	cmusfm_socket_file = get_cmusfm_socket_file();
+	cmusfm_state_file = get_cmusfm_state_file();
+
+	if (strcmp(argv[1], "init") == 0) {
+		cmusfm_initialization();
+		return EXIT_SUCCESS;
+	}
+
+	if (cmusfm_config_read(cmusfm_config_file, &config) == -1) {
+		perror("ERROR: Read config");
+		return EXIT_FAILURE;
+	}
+
+	if (strcmp(argv[1], "server") == 0) {
+		if (cmusfm_server_start() == -1) {
+			perror("ERROR: Start server");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (import)
+		return cmusfm_import_file(argv[2]);
+
+	if (replay)
+		return cmusfm_replay_file(argv[2], argc == 4 ? atof(argv[3]) : 0);
+
+	fprintf(stderr, "ERROR: Unknown command: %s\n", argv[1]);
+	return EXIT_FAILURE;
+}
@@ -13,13 +13,18 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
-#include <poll.h>
+#include <limits.h>
 #include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/file.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/un.h>
 #if HAVE_SYS_INOTIFY_H
 # include <sys/inotify.h>
@@ -29,11 +34,19 @@
 #include "cmusfm.h"
 #include "config.h"
 #include "debug.h"
+#include "events.h"
+#include "index.h"
+#include "loop.h"
+#include "playstate.h"
+#include "status.h"
 #if ENABLE_LIBNOTIFY
 # include "notify.h"
 #endif
 
 
+/* The first file descriptor passed by the service manager. */
+#define SERVER_LISTEN_FDS_START 3
+
 /* Helper function for MB track ID retrieval. */
 static char *get_record_mb_track_id(const struct cmusfm_data_record *r) {
 	return (char *)(r + 1);
@@ -64,6 +77,21 @@ static char *get_record_location(const struct cmusfm_data_record *r) {
 	return &((char *)(r + 1))[r->off_location];
 }
 
+/* Return the size of the record including all strings. */
+static size_t get_record_size(const struct cmusfm_data_record *r) {
+	return sizeof(*r) + r->off_location + strlen(get_record_location(r)) + 1;
+}
+
+/* Check whether all strings of the record of the given size are within
+ * the record boundaries. */
+static bool is_record_valid(const struct cmusfm_data_record *r, size_t size) {
+	const char *data = (const char *)(r + 1);
+	size -= sizeof(*r);
+	return r->off_artist < size && r->off_album_artist < size &&
+		r->off_album < size && r->off_title < size && r->off_location < size &&
+		data[size - 1] == '\0';
+}
+
 /* Return the checksum for the length-invariant part of the record. */
 static uint8_t make_record_checksum1(const struct cmusfm_data_record *r) {
 	return make_data_hash((unsigned char *)&r->status,
@@ -78,334 +106,287 @@ static uint8_t make_record_checksum2(const struct cmusfm_data_record *r) {
 			r->off_location + strlen(get_record_location(r)));
 }
 
-/* Copy data from the message into the scrobbler structure. */
-static void set_trackinfo(scrobbler_trackinfo_t *sbt,
-		const struct cmusfm_data_record *record) {
-
-	char *tmp;
-
-	tmp = get_record_mb_track_id(record);
-	sbt->mb_track_id = tmp[0] != '\0' ? tmp : NULL;
-	tmp = get_record_artist(record);
-	sbt->artist = tmp[0] != '\0' ? tmp : NULL;
-	tmp = get_record_album_artist(record);
-	sbt->album_artist = tmp[0] != '\0' ? tmp : NULL;
-	tmp = get_record_album(record);
-	sbt->album = tmp[0] != '\0' ? tmp : NULL;
-	sbt->track_number = record->track_number;
-	tmp = get_record_title(record);
-	sbt->track = tmp[0] != '\0' ? tmp : NULL;
-	sbt->duration = record->duration;
-	sbt->timestamp = 0;
-
+/* Default clock source used by the play-state machine. */
+static time_t cmusfm_server_clock_realtime(void) {
+	return time(NULL);
 }
 
-/* Process real server task - Last.fm submission. */
-static void cmusfm_server_process_data(scrobbler_session_t *sbs,
-		const struct cmusfm_data_record *record) {
-
-	static char saved_data[CMSOCKET_BUFFER_SIZE];
-	static char saved_is_radio = 0;
-	struct cmusfm_data_record *saved_record = (struct cmusfm_data_record *)saved_data;
-
-	/* scrobbler stuff */
-	static time_t scrobbler_fail_time = 1;
-	static time_t started = 0, paused = 0, unpaused = 0;
-	static time_t playtime = 0, fulltime = 10;
-	scrobbler_trackinfo_t sb_tinf;
-	unsigned char status;
-	time_t pausedtime;
-	int checksum2;
-
-	/* check for data integrity */
-	if (make_record_checksum1(record) != record->checksum1 ||
-			(checksum2 = make_record_checksum2(record)) != record->checksum2)
-		return;
-
-	debug("Payload: %s - %s - %d. %s (%ds)",
-			get_record_artist(record), get_record_album(record),
-			record->track_number, get_record_title(record),
-			record->duration);
-	debug("Location: %s", get_record_location(record));
-
-#if DEBUG && !defined(DEBUG_SKIP_HICCUP)
-	/* simulate server "hiccup" (e.g. internet connection issue) */
-	debug("Server hiccup test (5s)");
-	sleep(5);
-#endif
-
-	status = record->status & ~CMSTATUS_SHOUTCASTMASK;
-
-	/* test connection to server (on failure try again in some time) */
-	if (scrobbler_fail_time != 0 &&
-			time(NULL) - scrobbler_fail_time > SERVICE_RETRY_DELAY) {
-		if (scrobbler_test_session_key(sbs) == 0) {  /* everything should be OK now */
-			scrobbler_fail_time = 0;
-
-			/* if there is something in cache submit it */
-			cmusfm_cache_submit(sbs);
-		}
-		else
-			scrobbler_fail_time = time(NULL);
-	}
-
-	/* User is playing a new track or the status has changed for the previous
-	 * one. In both cases we should check if the track should be submitted. */
-	if (checksum2 != saved_record->checksum2) {
-action_submit:
-		playtime += time(NULL) - unpaused;
-
-		/* Track should be submitted if it is longer than 30 seconds and it has
-		 * been played for at least half its duration (play time is greater than
-		 * 15 seconds or 50% of the track duration respectively). Also the track
-		 * should be submitted if the play time is greater than 4 minutes. */
-		if (started != 0 && (playtime > fulltime - playtime || playtime > 240)) {
-
-			/* playing duration is OK so submit track */
-			set_trackinfo(&sb_tinf, saved_record);
-			sb_tinf.timestamp = started;
-
-			if (sb_tinf.duration <= 30)
-				goto action_submit_skip;
-
-			if ((saved_is_radio && !config.submit_shoutcast) ||
-					(!saved_is_radio && !config.submit_localfile)) {
-				/* skip submission if we don't want it */
-				debug("Submission not enabled");
-				goto action_submit_skip;
-			}
-
-			if (scrobbler_fail_time == 0) {
-				if (scrobbler_scrobble(sbs, &sb_tinf) != 0) {
-					scrobbler_fail_time = 1;
-					goto action_submit_failed;
-				}
-			}
-			else  /* write data to cache */
-action_submit_failed:
-				cmusfm_cache_update(&sb_tinf);
-		}
-
-action_submit_skip:
-		if (status == CMSTATUS_STOPPED)
-			started = 0;
-		else {
-			/* reinitialize variables, save track info in save_data */
-			started = unpaused = time(NULL);
-			playtime = paused = 0;
-
-			if ((record->status & CMSTATUS_SHOUTCASTMASK) != 0)
-				/* you have to listen radio min 90s (50% of 180) */
-				fulltime = 180;  /* overrun DEVBYZERO in URL mode :) */
-			else
-				fulltime = record->duration;
+/* clock source for the play-state machine */
+static time_t (*cmusfm_server_clock)(void) = cmusfm_server_clock_realtime;
 
-			/* save information for later submission purpose */
-			memcpy(saved_data, record, sizeof(saved_data));
-			saved_is_radio = record->status & CMSTATUS_SHOUTCASTMASK;
-
-			if (status == CMSTATUS_PLAYING) {
-action_nowplaying:
-				set_trackinfo(&sb_tinf, record);
-
-#if ENABLE_LIBNOTIFY
-				if (config.notification)
-					cmusfm_notify_show(&sb_tinf, get_album_cover_file(
-								get_record_location(record), config.format_coverfile));
-				else
-					debug("Notification not enabled");
-#endif
-
-				/* update now-playing indicator */
-				if (scrobbler_fail_time == 0) {
-					if ((saved_is_radio && config.nowplaying_shoutcast) ||
-							(!saved_is_radio && config.nowplaying_localfile)) {
-						if (scrobbler_update_now_playing(sbs, &sb_tinf) != 0)
-							scrobbler_fail_time = 1;
-					}
-					else
-						debug("Now playing not enabled");
-				}
+/* Set the clock source used by the play-state machine. If the given clock
+ * is NULL, the wall-clock time will be used. This function allows to drive
+ * the state machine with a simulated time. */
+void cmusfm_server_set_clock(time_t (*clock)(void)) {
+	cmusfm_server_clock = clock != NULL ? clock : cmusfm_server_clock_realtime;
+}
 
-			}
-		}
+/* The maximal number of player sessions tracked by the server. */
+#define SERVER_MAX_SESSIONS 16
+
+/* Play-state of the player session. The state of all sessions is persisted
+ * in the state file after every change, so the accounting of the current
+ * track survives the server restart (e.g. after the idle exit). */
+struct cmusfm_server_session {
+	/* player session ID (forwarded by the client) */
+	char id[128];
+	struct cmusfm_playstate state;
+	/* time of the last status change */
+	time_t updated;
+};
+
+/* state file header - the integrity header for the session table */
+struct cmusfm_server_state_file {
+	char signature[4];
+	/* size of the session structure */
+	uint32_t size;
+	uint32_t count;
+	int checksum;
+	/* struct cmusfm_server_session sessions[]; */
+};
+
+static struct cmusfm_server_session sessions[SERVER_MAX_SESSIONS];
+static size_t sessions_len = 0;
+
+/* The scrobbling service is shared by all sessions, so the failure time
+ * is not a part of the session state. */
+static time_t scrobbler_fail_time = 1;
+
+/* Get the session with the given ID. If there is no such session, a new one
+ * is created. When the session table is full, the slot of the stopped (or
+ * least recently updated) session is reused. */
+static struct cmusfm_server_session *cmusfm_server_get_session(const char *id) {
+
+	struct cmusfm_server_session *session = NULL;
+	size_t i;
+
+	for (i = 0; i < sessions_len; i++)
+		if (strncmp(sessions[i].id, id, sizeof(sessions[i].id) - 1) == 0)
+			return &sessions[i];
+
+	if (sessions_len < SERVER_MAX_SESSIONS)
+		session = &sessions[sessions_len++];
+	else {
+		/* prefer stopped sessions, then the least recently updated one */
+		session = &sessions[0];
+		for (i = 1; i < sessions_len; i++)
+			if ((sessions[i].state.started == 0) > (session->state.started == 0) ||
+					((sessions[i].state.started == 0) == (session->state.started == 0) &&
+					 sessions[i].updated < session->updated))
+				session = &sessions[i];
+		debug("Session evicted: %s", session->id);
 	}
-	else {  /* old checksum2 == new checksum2 */
-		if (status == CMSTATUS_STOPPED)
-			goto action_submit;
 
-		if (status == CMSTATUS_PAUSED) {
-			paused = time(NULL);
-			playtime += paused - unpaused;
-		}
+	debug("New session: %s", id);
+	memset(session, 0, sizeof(*session));
+	strncpy(session->id, id, sizeof(session->id) - 1);
+	cmusfm_playstate_init(&session->state);
 
-		/* NOTE: There is no possibility to distinguish between replayed track
-		 *       and unpaused. We assumed that if track was paused before, this
-		 *       indicates that track is continued to play (unpaused). In other
-		 *       case track is played again, so we should submit previous play. */
-		if (status == CMSTATUS_PLAYING) {
-			if (paused) {
-				unpaused = time(NULL);
-				pausedtime = unpaused - paused;
-				paused = 0;
-				if (pausedtime > 120)
-					/* If playing was paused for more then 120 seconds, reinitialize
-					 * now playing notification (scrobbler and libnotify). */
-					goto action_nowplaying;
-			}
-			else
-				goto action_submit;
-		}
-	}
+	return session;
 }
 
-/* Check if server instance is running. If yes, this function returns 1,
- * otherwise 0 is returned. On error -1 is returned and errno is set
- * appropriately. */
-int cmusfm_server_check(void) {
+/* Save the session table into the state file if it has changed. The file
+ * is replaced atomically, so a crash during the write does not corrupt the
+ * previous snapshot. */
+static void cmusfm_server_save_state(void) {
 
-	struct sockaddr_un saddr = { .sun_family = AF_UNIX };
+	static struct cmusfm_server_session snapshot[SERVER_MAX_SESSIONS];
+	static size_t snapshot_len = 0;
+	struct cmusfm_server_state_file header = { .signature = "CMst" };
+	size_t size = sessions_len * sizeof(*sessions);
+	char tmp_file[PATH_MAX];
 	int fd;
 
-	strncpy(saddr.sun_path, cmusfm_socket_file, sizeof(saddr.sun_path) - 1);
+	if (cmusfm_state_file == NULL ||
+			(snapshot_len == sessions_len && memcmp(snapshot, sessions, size) == 0))
+		return;
 
-	if ((fd = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
-		return -1;
+	header.size = sizeof(*sessions);
+	header.count = sessions_len;
+	header.checksum = make_data_hash((unsigned char *)sessions, size);
 
-	/* check if behind the socket there is an active server instance */
-	if (connect(fd, (struct sockaddr *)(&saddr), sizeof(saddr)) == 0) {
+	snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", cmusfm_state_file);
+	if ((fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+		goto fail;
+	if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+			write(fd, sessions, size) != (ssize_t)size) {
 		close(fd);
-		return 1;
+		goto fail;
 	}
+	close(fd);
 
-	return 0;
-}
+	if (rename(tmp_file, cmusfm_state_file) == 0) {
+		memcpy(snapshot, sessions, size);
+		snapshot_len = sessions_len;
+		return;
+	}
 
-/* server shutdown stuff */
-static bool server_on = true;
-static void cmusfm_server_stop(int sig) {
-	(void)sig;
-	debug("Stopping server");
-	server_on = false;
+fail:
+	debug("Couldn't save state: %s", strerror(errno));
+	unlink(tmp_file);
+	/* force write on the next call */
+	snapshot_len = 0;
 }
 
-/* Start server instance. This function hangs until server is stopped.
- * Upon error -1 is returned. */
-int cmusfm_server_start(void) {
+/* Restore the session table from the state file. Snapshot which does not
+ * pass the integrity check is ignored. */
+static void cmusfm_server_restore_state(void) {
 
-	char buffer[CMSOCKET_BUFFER_SIZE];
-	scrobbler_session_t *sbs;
-#if HAVE_SYS_INOTIFY_H
-	struct inotify_event inot_even;
-#endif
-	size_t rd_len;
-	int retval;
+	static struct cmusfm_server_session snapshot[SERVER_MAX_SESSIONS];
+	const struct cmusfm_data_record *record;
+	struct cmusfm_server_state_file header = { 0 };
+	ssize_t rd_len = -1;
+	size_t i;
+	int fd;
 
-	debug("Starting server");
+	if (cmusfm_state_file == NULL ||
+			(fd = open(cmusfm_state_file, O_RDONLY | O_CLOEXEC)) == -1)
+		return;
+	if (read(fd, &header, sizeof(header)) == sizeof(header) &&
+			memcmp(header.signature, "CMst", sizeof(header.signature)) == 0 &&
+			header.size == sizeof(*snapshot) && header.count <= SERVER_MAX_SESSIONS)
+		rd_len = read(fd, snapshot, header.count * sizeof(*snapshot));
+	close(fd);
+
+	if (rd_len != (ssize_t)(header.count * sizeof(*snapshot)) ||
+			header.checksum != make_data_hash((unsigned char *)snapshot, rd_len))
+		goto fail;
 
-	/* setup poll structure for data reading */
-	struct pollfd pfds[3] = {
-		{ -1, POLLIN, 0 },  /* server */
-		{ -1, POLLIN, 0 },  /* client */
-		{ -1, POLLIN, 0 },  /* inotify */
-	};
+	for (i = 0; i < header.count; i++) {
+		record = (const struct cmusfm_data_record *)snapshot[i].state.saved_data;
+		if (snapshot[i].id[sizeof(snapshot[i].id) - 1] != '\0' ||
+				(snapshot[i].state.started != 0 &&
+				 (record->checksum1 != make_record_checksum1(record) ||
+					record->checksum2 != make_record_checksum2(record))))
+			goto fail;
+	}
 
-	struct sockaddr_un saddr = { .sun_family = AF_UNIX };
-	strncpy(saddr.sun_path, cmusfm_socket_file, sizeof(saddr.sun_path) - 1);
+	memcpy(sessions, snapshot, header.count * sizeof(*snapshot));
+	sessions_len = header.count;
 
-	if ((pfds[0].fd = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
-		return -1;
+	debug("State restored: sessions: %zu", sessions_len);
+	return;
 
-	/* initialize scrobbling library */
-	sbs = scrobbler_initialize(config.service_api_url,
-			config.service_auth_url, SC_api_key, SC_secret);
-	scrobbler_set_session_key(sbs, config.session_key);
+fail:
+	debug("Invalid state file: %s", cmusfm_state_file);
+}
 
-	/* catch signals which are used to quit server */
-	struct sigaction sigact = { .sa_handler = cmusfm_server_stop };
-	sigaction(SIGTERM, &sigact, NULL);
-	sigaction(SIGHUP, &sigact, NULL);
-	sigaction(SIGINT, &sigact, NULL);
-
-	/* create server communication socket */
-	unlink(saddr.sun_path);
-	if (bind(pfds[0].fd, (struct sockaddr *)(&saddr), sizeof(saddr)) == -1)
-		goto fail;
-	if (listen(pfds[0].fd, 2) == -1)
-		goto fail;
+/* Copy data from the message into the scrobbler structure. */
+static void set_trackinfo(scrobbler_trackinfo_t *sbt,
+		const struct cmusfm_data_record *record) {
 
-#if HAVE_SYS_INOTIFY_H
-	/* initialize inode notification to watch changes in the config file */
-	pfds[2].fd = inotify_init();
-	cmusfm_config_add_watch(pfds[2].fd);
-#endif
+	char *tmp;
 
-	debug("Entering server main loop");
-	while (server_on) {
+	tmp = get_record_mb_track_id(record);
+	sbt->mb_track_id = tmp[0] != '\0' ? tmp : NULL;
+	tmp = get_record_artist(record);
+	sbt->artist = tmp[0] != '\0' ? tmp : NULL;
+	tmp = get_record_album_artist(record);
+	sbt->album_artist = tmp[0] != '\0' ? tmp : NULL;
+	tmp = get_record_album(record);
+	sbt->album = tmp[0] != '\0' ? tmp : NULL;
+	sbt->track_number = record->track_number;
+	tmp = get_record_title(record);
+	sbt->track = tmp[0] != '\0' ? tmp : NULL;
+	sbt->duration = record->duration;
+	sbt->timestamp = 0;
 
-		if (poll(pfds, 3, -1) == -1)
-			break;  /* signal interruption */
+}
 
-		if (pfds[0].revents & POLLIN) {
-			pfds[1].fd = accept(pfds[0].fd, NULL, NULL);
-			debug("New client accepted: %d", pfds[1].fd);
+/* Parse status arguments which we've get from the cmus (forwarded by the
+ * client as NULL-separated key-value pairs) and fill in the track info
+ * structure. Note, that the data has to be NULL-terminated. Upon error -1
+ * is returned. */
+static int get_track_info(struct cmtrack_info *tinfo, char *data, size_t len) {
+
+	char *end = &data[len];
+	char *key, *value;
+
+	memset(tinfo, 0, sizeof(*tinfo));
+	tinfo->status = CMSTATUS_UNDEFINED;
+
+	while (data < end) {
+
+		key = data;
+		value = &key[strlen(key) + 1];
+		if (value >= end)
+			break;
+		data = &value[strlen(value) + 1];
+
+		debug("Received argument: %s: %s", key, value);
+		if (strcmp(key, "status") == 0) {
+			if (strcmp(value, "playing") == 0)
+				tinfo->status = CMSTATUS_PLAYING;
+			else if (strcmp(value, "paused") == 0)
+				tinfo->status = CMSTATUS_PAUSED;
+			else if (strcmp(value, "stopped") == 0)
+				tinfo->status = CMSTATUS_STOPPED;
 		}
+		else if (strcmp(key, "session") == 0)
+			tinfo->session = value;
+		else if (strcmp(key, "file") == 0)
+			tinfo->file = value;
+		else if (strcmp(key, "url") == 0)
+			tinfo->url = value;
+		/* ID3 metadata exposed by cmus */
+		else if (strcmp(key, "artist") == 0)
+			tinfo->artist = value;
+		else if (strcmp(key, "albumartist") == 0)
+			tinfo->album_artist = value;
+		else if (strcmp(key, "album") == 0)
+			tinfo->album = value;
+		else if (strcmp(key, "discnumber") == 0)
+			tinfo->disc_number = atoi(value);
+		else if (strcmp(key, "tracknumber") == 0)
+			tinfo->track_number = atoi(value);
+		else if (strcmp(key, "title") == 0)
+			tinfo->title = value;
+		else if (strcmp(key, "musicbrainz_trackid") == 0)
+			tinfo->mb_track_id = value;
+		else if (strcmp(key, "date") == 0)
+			tinfo->date = value;
+		else if (strcmp(key, "duration") == 0)
+			tinfo->duration = atoi(value);
+	}
 
-		if (pfds[1].revents & POLLIN && pfds[1].fd != -1) {
-			rd_len = read(pfds[1].fd, buffer, sizeof(buffer));
-			close(pfds[1].fd);
-			pfds[1].fd = -1;
-			if (rd_len >= sizeof(struct cmusfm_data_record))
-				cmusfm_server_process_data(sbs, (struct cmusfm_data_record *)buffer);
-		}
+	/* NOTE: cmus always passes status parameter */
+	if (tinfo->status == CMSTATUS_UNDEFINED)
+		return -1;
 
-#if HAVE_SYS_INOTIFY_H
-		if (pfds[2].revents & POLLIN) {
-			/* We're watching only one file, so the result is of no importance
-			 * to us, simply read out the inotify file descriptor. */
-			read(pfds[2].fd, &inot_even, sizeof(inot_even));
-			debug("Inotify event occurred: %x", inot_even.mask);
-			cmusfm_config_read(cmusfm_config_file, &config);
-			cmusfm_config_add_watch(pfds[2].fd);
-		}
-#endif
-	}
+	return 0;
+}
 
-	retval = 0;
-	goto final;
+/* compiled file name formats */
+static struct format_regexp format_localfile;
+static struct format_regexp format_shoutcast;
 
-fail:
-	retval = -1;
+/* Compile file name formats from the current configuration. */
+static void cmusfm_server_compile_formats(void) {
 
-final:
+	free_format_regexp(&format_localfile);
+	if (compile_format_regexp(&format_localfile, config.format_localfile) == -1)
+		fprintf(stderr, "ERROR: Invalid format-localfile: %s\n", config.format_localfile);
 
-#if HAVE_SYS_INOTIFY_H
-	close(pfds[2].fd);
-#endif
-#if ENABLE_LIBNOTIFY
-	cmusfm_notify_free();
-#endif
-	scrobbler_free(sbs);
-	close(pfds[0].fd);
-	unlink(saddr.sun_path);
+	free_format_regexp(&format_shoutcast);
+	if (compile_format_regexp(&format_shoutcast, config.format_shoutcast) == -1)
+		fprintf(stderr, "ERROR: Invalid format-shoutcast: %s\n", config.format_shoutcast);
 
-	return retval;
 }
 
-/* Send track info to server instance. */
-int cmusfm_server_send_track(struct cmtrack_info *tinfo) {
+/* Make the track record from the track info structure. On success this
+ * function returns 0, otherwise (e.g. file name does not match the format)
+ * -1 is returned. */
+static int make_record(char buffer[CMSOCKET_BUFFER_SIZE], struct cmtrack_info *tinfo) {
 
-	char buffer[CMSOCKET_BUFFER_SIZE] = { 0 };
 	struct cmusfm_data_record *record = (struct cmusfm_data_record *)buffer;
-	struct format_match *match, *matches;
-	int err, sock;
+	struct format_match *match, matches[FORMAT_MATCH_TYPE_COUNT + 1];
 
 	/* helper accessors for dynamic fields */
 	char *mb_track_id = &buffer[sizeof(*record)];
 	char *artist, *album_artist, *album, *title, *location;
-	size_t size = sizeof(buffer) - (mb_track_id - buffer) - 6;
+	size_t size = CMSOCKET_BUFFER_SIZE - (mb_track_id - buffer) - 6;
 
-	debug("Sending track to server");
+	memset(buffer, 0, CMSOCKET_BUFFER_SIZE);
 
 	record->status = tinfo->status;
 	record->disc_number = tinfo->disc_number;
@@ -433,20 +414,18 @@ int cmusfm_server_send_track(struct cmtrack_info *tinfo) {
 		if (tinfo->url != NULL) {
 			/* URL: try to fetch artist and track tile form the 'title' field */
 
-			matches = get_regexp_format_matches(tinfo->title, config.format_shoutcast);
-			if (matches == NULL) {
+			if (get_format_matches(&format_shoutcast, tinfo->title, matches) == -1) {
 				fprintf(stderr, "INFO: Title does not match format-shoutcast\n");
-				return 0;
+				return -1;
 			}
 		}
 		else {
 			/* FILE: try to fetch artist and track title from the 'file' field */
 
 			tinfo->file = basename(tinfo->file);
-			matches = get_regexp_format_matches(tinfo->file, config.format_localfile);
-			if (matches == NULL) {
+			if (get_format_matches(&format_localfile, tinfo->file, matches) == -1) {
 				fprintf(stderr, "INFO: File name does not match format-localfile\n");
-				return 0;
+				return -1;
 			}
 		}
 
@@ -464,8 +443,6 @@ int cmusfm_server_send_track(struct cmtrack_info *tinfo) {
 		match = get_regexp_match(matches, CMFORMAT_TITLE);
 		strncpy(title, match->data, size < match->len ? size : match->len);
 
-		free(matches);
-
 	}
 	else {
 
@@ -508,31 +485,929 @@ int cmusfm_server_send_track(struct cmtrack_info *tinfo) {
 	record->checksum1 = make_record_checksum1(record);
 	record->checksum2 = make_record_checksum2(record);
 
-	/* connect to the communication socket */
+	return 0;
+}
+
+/* The number of cached tracks submitted in a single event loop iteration,
+ * which is the number of tracks sent with a single scrobble request. */
+#define SERVER_CACHE_DRAIN_BATCH SCROBBLER_BATCH_SIZE
+
+/* position of the next cache record to be submitted */
+static struct cmusfm_cache_position cache_drain_pos = { 0 };
+static int cache_drain_timer = -1;
+/* the (approximate) number of tracks in the offline cache */
+static size_t cache_queue = 0;
+
+/* shadow copy of the published status board */
+static struct cmusfm_status status_board;
+
+/* Get the name of the player status. */
+static const char *get_cmstatus_name(enum cmstatus status) {
+	switch (status & ~CMSTATUS_SHOUTCASTMASK) {
+	case CMSTATUS_PLAYING:
+		return "playing";
+	case CMSTATUS_PAUSED:
+		return "paused";
+	case CMSTATUS_STOPPED:
+		return "stopped";
+	default:
+		return "unknown";
+	}
+}
+
+/* Broadcast the track related event to the event subscribers. */
+static void cmusfm_server_broadcast_track(const char *event, const char *session,
+		const struct cmusfm_data_record *record, time_t timestamp) {
+
+	const struct cmusfm_event_data data[] = {
+		{ "session", CMUSFM_EVENT_DATA_TYPE_STRING, { .s = session } },
+		{ "artist", CMUSFM_EVENT_DATA_TYPE_STRING, { .s = get_record_artist(record) } },
+		{ "album", CMUSFM_EVENT_DATA_TYPE_STRING, { .s = get_record_album(record) } },
+		{ "title", CMUSFM_EVENT_DATA_TYPE_STRING, { .s = get_record_title(record) } },
+		{ "duration", CMUSFM_EVENT_DATA_TYPE_NUMBER, { .n = record->duration } },
+		{ "location", CMUSFM_EVENT_DATA_TYPE_STRING, { .s = get_record_location(record) } },
+		{ "timestamp", CMUSFM_EVENT_DATA_TYPE_NUMBER, { .n = timestamp } },
+	};
+
+	/* timestamp is meaningful for submitted tracks only */
+	cmusfm_events_broadcast(event, data, timestamp != 0 ? 7 : 6);
+}
+
+/* Publish the play-state of the given session and the received record on
+ * the status board. If the session is NULL, only the server state (i.e.
+ * the service availability and the cache queue) is updated. The change of
+ * the service availability is also broadcast to the event subscribers. */
+static void cmusfm_server_publish_status(const struct cmusfm_server_session *session,
+		const struct cmusfm_data_record *record) {
+
+	const struct cmusfm_playstate *ps;
+	bool online = scrobbler_fail_time == 0;
+
+	if (online != status_board.online) {
+		const struct cmusfm_event_data data[] = {
+			{ "online", CMUSFM_EVENT_DATA_TYPE_BOOLEAN, { .b = online } },
+			{ "queue", CMUSFM_EVENT_DATA_TYPE_NUMBER, { .n = cache_queue } },
+		};
+		cmusfm_events_broadcast("service", data, 2);
+	}
+
+	status_board.queue = cache_queue;
+	status_board.online = online;
+
+	if (session != NULL) {
+
+		ps = &session->state;
+		status_board.updated = session->updated;
+		status_board.unpaused = ps->unpaused;
+		status_board.playtime = ps->playtime;
+		status_board.submit_playtime = cmusfm_playstate_get_submit_playtime(ps, &config);
+		status_board.status = ps->started != 0 ?
+			record->status & ~CMSTATUS_SHOUTCASTMASK : CMSTATUS_STOPPED;
+
+		memset(status_board.artist, 0, sizeof(status_board.artist));
+		memset(status_board.album, 0, sizeof(status_board.album));
+		memset(status_board.title, 0, sizeof(status_board.title));
+		status_board.duration = 0;
+
+		if (ps->started != 0) {
+			/* play-state refers to the saved record */
+			record = (const struct cmusfm_data_record *)ps->saved_data;
+			strncpy(status_board.artist, get_record_artist(record), sizeof(status_board.artist) - 1);
+			strncpy(status_board.album, get_record_album(record), sizeof(status_board.album) - 1);
+			strncpy(status_board.title, get_record_title(record), sizeof(status_board.title) - 1);
+			status_board.duration = record->duration;
+		}
+
+	}
+
+	cmusfm_status_publish(&status_board);
+}
+
+/* Submit the next batch of cached tracks. The cache is drained in small
+ * batches from the event loop, so the status messages received during the
+ * drain (now-playing and live scrobbles) are not delayed by the backlog.
+ * Batches are paced with the event loop timer according to the scrobbler
+ * session rate limiter, so the server never sleeps waiting for it. */
+static void cmusfm_server_cache_drain_cb(void *data) {
+
+	scrobbler_session_t *sbs = data;
+
+	cache_drain_timer = -1;
+	/* drain is resumed after the service reconnection */
+	if (scrobbler_fail_time != 0)
+		return;
+
+	switch (cmusfm_cache_drain(sbs, &cache_drain_pos, SERVER_CACHE_DRAIN_BATCH)) {
+	case 0:
+		cache_queue = 0;
+		break;
+	case 1:
+		cache_queue -= cache_queue < SERVER_CACHE_DRAIN_BATCH ? cache_queue : SERVER_CACHE_DRAIN_BATCH;
+		cache_drain_timer = cmusfm_loop_add_timer(scrobbler_get_rate_limit_delay(sbs),
+				cmusfm_server_cache_drain_cb, sbs);
+		break;
+	case -1:
+		scrobbler_fail_time = cmusfm_server_clock();
+		break;
+	case -2:
+		/* service is available, but it has rejected the request */
+		cache_drain_timer = cmusfm_loop_add_timer(scrobbler_get_rate_limit_delay(sbs),
+				cmusfm_server_cache_drain_cb, sbs);
+		break;
+	}
+
+	cmusfm_server_publish_status(NULL, NULL);
+
+}
+
+/* timer of the deferred scrobble batch submission */
+static int scrobble_batch_timer = -1;
+
+/* Schedule the submission of cached tracks, as soon as the rate limiter
+ * allows the next request. */
+static void cmusfm_server_cache_drain(scrobbler_session_t *sbs) {
+	/* deferred scrobbles are submitted along with the cache */
+	if (scrobble_batch_timer != -1)
+		cmusfm_loop_remove_timer(scrobble_batch_timer);
+	scrobble_batch_timer = -1;
+	if (cache_drain_timer == -1)
+		cache_drain_timer = cmusfm_loop_add_timer(scrobbler_get_rate_limit_delay(sbs),
+				cmusfm_server_cache_drain_cb, sbs);
+}
+
+static void cmusfm_server_scrobble_batch_cb(void *data) {
+	scrobble_batch_timer = -1;
+	cmusfm_server_cache_drain(data);
+}
+
+/* Schedule the submission of scrobbles deferred in the offline cache. The
+ * batch is submitted after the configured interval (counted from the first
+ * deferred scrobble), or immediately when the size limit is reached. */
+static void cmusfm_server_scrobble_batch(scrobbler_session_t *sbs) {
+	if (config.scrobble_batch_size != 0 && cache_queue >= config.scrobble_batch_size)
+		cmusfm_server_cache_drain(sbs);
+	else if (scrobble_batch_timer == -1 && cache_drain_timer == -1)
+		scrobble_batch_timer = cmusfm_loop_add_timer(config.scrobble_batch_interval * 60 * 1000,
+				cmusfm_server_scrobble_batch_cb, sbs);
+}
+
+/* Delay (in milliseconds) of the offline cache group commit. */
+#define SERVER_CACHE_SYNC_DELAY 2000
+
+static int cache_sync_timer = -1;
+
+static void cmusfm_server_cache_sync_cb(void *data) {
+	(void)data;
+	cache_sync_timer = -1;
+	cmusfm_cache_sync();
+}
+
+/* Write track to the offline cache. With the batch synchronization policy,
+ * tracks cached within the short period of time (e.g. upon the network
+ * failure) are synchronized with the storage device at once. */
+static void cmusfm_server_cache_update(const scrobbler_trackinfo_t *sb_tinf) {
+	cmusfm_cache_update(sb_tinf);
+	cache_queue++;
+	if (config.cache_sync == CMUSFM_CACHE_SYNC_BATCH && cache_sync_timer == -1)
+		cache_sync_timer = cmusfm_loop_add_timer(SERVER_CACHE_SYNC_DELAY,
+				cmusfm_server_cache_sync_cb, NULL);
+}
+
+/* Execute actions requested by the play-state machine - Last.fm submission
+ * and desktop notification. */
+static void cmusfm_server_execute(scrobbler_session_t *sbs,
+		const struct cmusfm_data_record *record, unsigned int actions,
+		const struct cmusfm_playstate_submit *submit) {
+
+	scrobbler_trackinfo_t sb_tinf;
+	scrobbler_status_t sb_status;
+	const char *event;
+
+	if (actions & (CMUSFM_PLAYSTATE_NOTIFY | CMUSFM_PLAYSTATE_NOWPLAYING))
+		set_trackinfo(&sb_tinf, record);
+
+#if ENABLE_LIBNOTIFY
+	if (actions & CMUSFM_PLAYSTATE_NOTIFY)
+		cmusfm_notify_show(&sb_tinf, get_album_cover_file(
+					get_record_location(record), config.format_coverfile));
+#endif
+
+	/* update now-playing indicator */
+	if (actions & CMUSFM_PLAYSTATE_NOWPLAYING)
+		if (scrobbler_update_now_playing(sbs, &sb_tinf) != 0 &&
+				!scrobbler_is_rate_limited(sbs))
+			scrobbler_fail_time = 1;
+
+	/* The now-playing update is the only interactive part of the submission,
+	 * so the track played previously is scrobbled afterwards. */
+	if (actions & (CMUSFM_PLAYSTATE_SCROBBLE | CMUSFM_PLAYSTATE_CACHE)) {
+		set_trackinfo(&sb_tinf, (const struct cmusfm_data_record *)submit->data);
+		sb_tinf.timestamp = submit->timestamp;
+		event = "cache";
+		/* service might have failed during the now-playing update */
+		if (actions & CMUSFM_PLAYSTATE_CACHE || scrobbler_fail_time != 0)
+			cmusfm_server_cache_update(&sb_tinf);
+		else if (config.scrobble_batch_interval != 0) {
+			/* Defer the scrobble, so many scrobbles are submitted with a single
+			 * request - the number of network wake-ups is reduced. */
+			cmusfm_server_cache_update(&sb_tinf);
+			cmusfm_server_scrobble_batch(sbs);
+		}
+		else if ((sb_status = cmusfm_index_scrobble(sbs, &sb_tinf)) == 0)
+			event = "scrobble";
+		else if (scrobbler_is_rate_limited(sbs)) {
+			/* Service is available, so the track is submitted from the cache as
+			 * soon as the rate limiter allows it. */
+			cmusfm_server_cache_update(&sb_tinf);
+			cmusfm_server_cache_drain(sbs);
+		}
+		else {
+			scrobbler_fail_time = 1;
+			/* Track sent without the response might have been delivered, but
+			 * it is cached anyway, so it is not lost if it has not been. */
+			if (sb_status == SCROBBLER_STATUS_ERR_NORESPONSE)
+				fprintf(stderr, "INFO: No response to scrobble, track cached for retry\n");
+			cmusfm_server_cache_update(&sb_tinf);
+		}
+		cmusfm_server_broadcast_track(event, NULL,
+				(const struct cmusfm_data_record *)submit->data, submit->timestamp);
+	}
+
+}
+
+/* executor of the play-state machine actions */
+static void (*cmusfm_server_executor)(scrobbler_session_t *,
+		const struct cmusfm_data_record *, unsigned int,
+		const struct cmusfm_playstate_submit *) = cmusfm_server_execute;
+
+/* capture file descriptor (-1 if capture is disabled) */
+static int capture_fd = -1;
+
+/* (Re)open the capture file given in the configuration. Relative file name
+ * is resolved against the cmus home directory. */
+static void cmusfm_server_capture_open(void) {
+
+	char *fname;
+
+	if (capture_fd != -1)
+		close(capture_fd);
+	capture_fd = -1;
+
+	if (config.capture_file[0] == '\0')
+		return;
+
+	if (config.capture_file[0] == '/')
+		fname = strdup(config.capture_file);
+	else
+		fname = get_cmus_home_file(config.capture_file);
+
+	debug("Capture file: %s", fname);
+	if ((capture_fd = open(fname, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600)) == -1)
+		fprintf(stderr, "ERROR: Open capture file: %s: %s\n", fname, strerror(errno));
+
+	free(fname);
+}
+
+/* Append the received track record into the capture file. Records are
+ * stored in the native byte order, exactly as they were received. */
+static void cmusfm_server_capture(const char *session,
+		const struct cmusfm_data_record *record, time_t now) {
+
+	char buffer[sizeof(struct cmusfm_capture_record) + 128 + CMSOCKET_BUFFER_SIZE];
+	struct cmusfm_capture_record *header = (struct cmusfm_capture_record *)buffer;
+	size_t len_session = strnlen(session, 127) + 1;
+	size_t len_record = get_record_size(record);
+	char *ptr = (char *)(header + 1);
+
+	header->signature = CMUSFM_CAPTURE_SIGNATURE;
+	header->len_session = len_session;
+	header->len_record = len_record;
+	header->timestamp = now;
+
+	memcpy(ptr, session, len_session - 1);
+	ptr[len_session - 1] = '\0';
+	memcpy(ptr + len_session, record, len_record);
+
+	/* single write, so the capture is not interleaved with other writers */
+	len_record += sizeof(*header) + len_session;
+	if (write(capture_fd, buffer, len_record) != (ssize_t)len_record)
+		debug("Couldn't write capture: %s", strerror(errno));
+
+}
+
+/* Process the track record received from the player. The play-state of the
+ * session is updated by the state machine, and the requested actions are
+ * passed to the executor. */
+static void cmusfm_server_process_data(scrobbler_session_t *sbs,
+		struct cmusfm_server_session *session, const struct cmusfm_data_record *record) {
+
+	const struct cmusfm_data_record *saved;
+	struct cmusfm_playstate_submit submit;
+	unsigned int actions;
+	time_t now, started;
+	uint8_t checksum;
+	bool recovery;
+
+	/* check for data integrity */
+	if (make_record_checksum1(record) != record->checksum1 ||
+			make_record_checksum2(record) != record->checksum2)
+		return;
+
+	debug("Payload: %s - %s - %d. %s (%ds)",
+			get_record_artist(record), get_record_album(record),
+			record->track_number, get_record_title(record),
+			record->duration);
+	debug("Location: %s", get_record_location(record));
+
+#if DEBUG && !defined(DEBUG_SKIP_HICCUP)
+	/* simulate server "hiccup" (e.g. internet connection issue) */
+	debug("Server hiccup test (5s)");
+	sleep(5);
+#endif
+
+	now = session->updated = cmusfm_server_clock();
+
+	if (capture_fd != -1)
+		cmusfm_server_capture(session->id, record, now);
+
+	/* The recovery is optimistic - the service is assumed to be available
+	 * again, and the result of the actual request (e.g. the now-playing
+	 * update) tells whether it is. On failure try again in some time. */
+	if ((recovery = scrobbler_fail_time != 0 &&
+				now - scrobbler_fail_time > SERVICE_RETRY_DELAY))
+		scrobbler_fail_time = 0;
+
+	saved = (const struct cmusfm_data_record *)session->state.saved_data;
+	started = session->state.started;
+	checksum = saved->checksum2;
+
+	actions = cmusfm_playstate_update(&session->state, &config, record, now,
+			scrobbler_fail_time == 0, &submit);
+	cmusfm_server_executor(sbs, record, actions, &submit);
+
+	if (recovery) {
+		/* Without any request to send (the cache drain is such request as
+		 * well), the session has to be verified with the separate probe. */
+		if (scrobbler_fail_time == 0 && cache_queue == 0 &&
+				!(actions & (CMUSFM_PLAYSTATE_NOWPLAYING | CMUSFM_PLAYSTATE_SCROBBLE)) &&
+				scrobbler_test_session_key(sbs) != 0 &&
+				!scrobbler_is_rate_limited(sbs))
+			scrobbler_fail_time = 1;
+		if (scrobbler_fail_time != 0)
+			scrobbler_fail_time = now;
+		else
+			/* if there is something in cache submit it */
+			cmusfm_server_cache_drain(sbs);
+	}
+
+	if (cmusfm_events_subscribers() > 0) {
+		const struct cmusfm_event_data data[] = {
+			{ "session", CMUSFM_EVENT_DATA_TYPE_STRING, { .s = session->id } },
+			{ "status", CMUSFM_EVENT_DATA_TYPE_STRING, { .s = get_cmstatus_name(record->status) } },
+		};
+		/* new play has been started (either new track or replay) */
+		if (session->state.started != 0 &&
+				(session->state.started != started || saved->checksum2 != checksum))
+			cmusfm_server_broadcast_track("track", session->id, saved, 0);
+		cmusfm_events_broadcast("status", data, 2);
+	}
+
+	cmusfm_server_save_state();
+	cmusfm_server_publish_status(session, record);
+}
+
+/* The maximal time (in seconds) for receiving the message from the pending
+ * client during the server shutdown. */
+#define SERVER_CLIENT_TIMEOUT 1
+
+/* Client connection with the partially received message. */
+struct cmusfm_server_client {
+	scrobbler_session_t *sbs;
+	size_t len;
+	char buffer[CMSOCKET_MESSAGE_SIZE];
+};
+
+/* Process message received from the client. The client socket is required
+ * for the subscription request only, so it might be -1. */
+static void cmusfm_server_process_message(scrobbler_session_t *sbs,
+		int client, char *buffer, size_t len) {
+
+	struct cmusfm_message *msg = (struct cmusfm_message *)buffer;
+	char *data = (char *)(msg + 1);
+	char record[CMSOCKET_BUFFER_SIZE];
+	struct cmtrack_info tinfo;
+	int fd;
+
+	/* check for data integrity */
+	if (len < sizeof(*msg) || len != sizeof(*msg) + msg->length ||
+			msg->checksum != (uint8_t)make_data_hash((unsigned char *)data, msg->length))
+		return;
+	/* make sure that all strings are NULL-terminated */
+	if (msg->length != 0 && data[msg->length - 1] != '\0')
+		return;
+
+	switch (msg->type) {
+	case CMMESSAGE_STATUS:
+		if (get_track_info(&tinfo, data, msg->length) == -1) {
+			debug("Invalid status message");
+			break;
+		}
+		if (make_record(record, &tinfo) == 0)
+			cmusfm_server_process_data(sbs,
+					cmusfm_server_get_session(tinfo.session != NULL ? tinfo.session : ""),
+					(struct cmusfm_data_record *)record);
+		break;
+	case CMMESSAGE_SUBSCRIBE:
+		if (client == -1 || (fd = fcntl(client, F_DUPFD_CLOEXEC, 0)) == -1)
+			break;
+		cmusfm_events_subscribe(fd);
+		break;
+	}
+
+}
+
+/* Check whether the whole message has been received. The length of the
+ * message is known as soon as the message header has arrived. */
+static bool cmusfm_server_message_complete(const char *buffer, size_t len) {
+	const struct cmusfm_message *msg = (const struct cmusfm_message *)buffer;
+	return len >= sizeof(*msg) && len >= sizeof(*msg) + msg->length;
+}
+
+/* Read the whole message from the client. The message is terminated by the
+ * length given in the message header, by the end-of-file or by the end of
+ * the buffer space. */
+static size_t cmusfm_server_read_message(int fd, char *buffer, size_t size) {
+
+	size_t len = 0;
+	ssize_t rv;
+
+	while (len < size && !cmusfm_server_message_complete(buffer, len) &&
+			(rv = read(fd, &buffer[len], size - len)) > 0)
+		len += rv;
+
+	return len;
+}
+
+static void cmusfm_server_idle_reset(void);
+
+/* Stop the server if there was no client activity for a while. Server is
+ * kept running as long as there are event subscribers. */
+static void cmusfm_server_idle_cb(void *data) {
+	(void)data;
+	debug("Idle timeout");
+	if (cmusfm_events_subscribers() > 0)
+		cmusfm_server_idle_reset();
+	else
+		cmusfm_loop_quit();
+}
+
+/* Restart the idle exit timer. */
+static void cmusfm_server_idle_reset(void) {
+
+	static int timer_id = -1;
+
+	if (timer_id != -1)
+		cmusfm_loop_remove_timer(timer_id);
+	timer_id = -1;
+
+	if (config.server_idle_timeout != 0)
+		timer_id = cmusfm_loop_add_timer(config.server_idle_timeout * 1000,
+				cmusfm_server_idle_cb, NULL);
+
+}
+
+/* Read the available data from the client. Client sockets are in the
+ * non-blocking mode, so the message might be received in parts. Once the
+ * whole message has arrived (or the client has closed the connection), the
+ * message is processed and the connection is closed. */
+static void cmusfm_server_client_cb(int fd, void *data) {
+
+	struct cmusfm_server_client *client = data;
+	ssize_t rv;
+
+	rv = read(fd, &client->buffer[client->len], sizeof(client->buffer) - client->len);
+	if (rv == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+	if (rv > 0) {
+		client->len += rv;
+		if (client->len < sizeof(client->buffer) &&
+				!cmusfm_server_message_complete(client->buffer, client->len))
+			return;
+	}
+
+	cmusfm_server_process_message(client->sbs, fd, client->buffer, client->len);
+	cmusfm_loop_remove_fd(fd);
+	close(fd);
+	free(client);
+
+	cmusfm_server_idle_reset();
+}
+
+/* Accept new client connection. */
+static void cmusfm_server_accept_cb(int fd, void *data) {
+
+	struct cmusfm_server_client *client;
+	int client_fd;
+
+	if ((client_fd = accept(fd, NULL, NULL)) == -1)
+		return;
+
+	debug("New client accepted: %d", client_fd);
+	/* slow client shall not stall the server */
+	fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK);
+
+	if ((client = malloc(sizeof(*client))) == NULL) {
+		fprintf(stderr, "ERROR: Accept client: %s\n", strerror(errno));
+		close(client_fd);
+		return;
+	}
+
+	client->sbs = data;
+	client->len = 0;
+
+	/* failure is reported by the event loop itself */
+	if (cmusfm_loop_add_fd(client_fd, cmusfm_server_client_cb, client) == -1) {
+		close(client_fd);
+		free(client);
+	}
+
+}
+
+#if HAVE_SYS_INOTIFY_H
+/* Reload configuration upon config file change. */
+static void cmusfm_server_inotify_cb(int fd, void *data) {
+
+	struct inotify_event inot_even;
+	(void)data;
+
+	/* We're watching only one file, so the result is of no importance
+	 * to us, simply read out the inotify file descriptor. */
+	read(fd, &inot_even, sizeof(inot_even));
+	debug("Inotify event occurred: %x", inot_even.mask);
+	cmusfm_config_read(cmusfm_config_file, &config);
+	cmusfm_config_add_watch(fd);
+	cmusfm_server_compile_formats();
+	cmusfm_server_capture_open();
+	cmusfm_server_idle_reset();
+
+}
+#endif
+
+/* server shutdown stuff */
+static void cmusfm_server_stop(int sig, void *data) {
+	(void)sig;
+	(void)data;
+	debug("Stopping server: %d", sig);
+	cmusfm_loop_quit();
+}
+
+/* Get the listening socket passed by the service manager, as described in
+ * the sd_listen_fds(3) manual. If there is no such socket, -1 is returned. */
+static int cmusfm_server_get_listen_fd(void) {
+
+	const char *pid, *fds;
+
+	if ((pid = getenv("LISTEN_PID")) == NULL ||
+			(fds = getenv("LISTEN_FDS")) == NULL)
+		return -1;
+	if (atol(pid) != getpid() || atoi(fds) < 1)
+		return -1;
+
+	/* do not pass the socket to our child processes */
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	fcntl(SERVER_LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+
+	debug("Using socket passed by the service manager");
+	return SERVER_LISTEN_FDS_START;
+}
+
+/* Notify the service manager about the server state change, as described
+ * in the sd_notify(3) manual. */
+static void cmusfm_server_notify_manager(const char *state) {
+
+	struct sockaddr_un saddr = { .sun_family = AF_UNIX };
+	const char *path;
+	socklen_t len;
+	int fd;
+
+	if ((path = getenv("NOTIFY_SOCKET")) == NULL)
+		return;
+	if ((path[0] != '/' && path[0] != '@') ||
+			strlen(path) >= sizeof(saddr.sun_path))
+		return;
+
+	strcpy(saddr.sun_path, path);
+	/* socket in the abstract namespace */
+	if (path[0] == '@')
+		saddr.sun_path[0] = '\0';
+	len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+
+	if ((fd = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1)
+		return;
+	debug("Service manager notification: %s", state);
+	sendto(fd, state, strlen(state), 0, (struct sockaddr *)&saddr, len);
+	close(fd);
+
+}
+
+/* Create the server communication socket. Concurrently started servers are
+ * serialized with the lock file, and the socket file is removed only if it
+ * is not used by the running server (e.g. it was left by a crashed one).
+ * If the lock is held by the server which is not responding (it is either
+ * starting or stopping), wait a while for the lock release. Upon error -1
+ * is returned. */
+static int cmusfm_server_bind(const struct sockaddr_un *saddr, int *lock_fd) {
+
+	char lock_file[sizeof(saddr->sun_path) + 8];
+	unsigned int retries = 40;
+	int fd;
+
+	snprintf(lock_file, sizeof(lock_file), "%s.lock", saddr->sun_path);
+	if ((*lock_fd = open(lock_file, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+		return -1;
+
+	while (flock(*lock_fd, LOCK_EX | LOCK_NB) == -1) {
+		if (cmusfm_server_check() == 1 || retries-- == 0) {
+			debug("Server is already running");
+			errno = EADDRINUSE;
+			return -1;
+		}
+		usleep(50000);
+	}
+
+	if (cmusfm_server_check() == 1) {
+		debug("Server is already running");
+		errno = EADDRINUSE;
+		return -1;
+	}
+
+	if ((fd = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
+		return -1;
+
+	unlink(saddr->sun_path);
+	if (bind(fd, (struct sockaddr *)saddr, sizeof(*saddr)) == -1 ||
+			listen(fd, 16) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Process all pending connections without blocking. */
+static void cmusfm_server_drain(int fd, scrobbler_session_t *sbs) {
+
+	struct timeval timeout = { .tv_sec = SERVER_CLIENT_TIMEOUT };
+	char buffer[CMSOCKET_MESSAGE_SIZE];
+	size_t rd_len;
+	int client;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	while ((client = accept(fd, NULL, NULL)) != -1) {
+		debug("Pending client accepted: %d", client);
+		/* accepted socket might inherit the non-blocking mode, however,
+		 * the client shall not be able to stall the server shutdown */
+		fcntl(client, F_SETFL, fcntl(client, F_GETFL) & ~O_NONBLOCK);
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		rd_len = cmusfm_server_read_message(client, buffer, sizeof(buffer));
+		close(client);
+		/* subscription makes no sense during the shutdown */
+		cmusfm_server_process_message(sbs, -1, buffer, rd_len);
+	}
+
+}
+
+/* Start server instance. This function hangs until server is stopped.
+ * If the server has been started by the service manager with the socket
+ * activation, the passed socket is used instead of creating a new one.
+ * Upon error -1 is returned. */
+int cmusfm_server_start(void) {
+
+	scrobbler_session_t *sbs;
+	int server_fd, lock_fd = -1, inotify_fd = -1;
+	size_t i, last;
+	bool activated = false;
+	int retval = -1;
+
+	debug("Starting server");
+
 	struct sockaddr_un saddr = { .sun_family = AF_UNIX };
 	strncpy(saddr.sun_path, cmusfm_socket_file, sizeof(saddr.sun_path) - 1);
 
-	if ((sock = socket(PF_UNIX, SOCK_STREAM, 0)) == -1)
-		goto fail;
-	if (connect(sock, (struct sockaddr *)(&saddr), sizeof(saddr)) == -1)
-		goto fail;
+	if ((server_fd = cmusfm_server_get_listen_fd()) != -1)
+		activated = true;
+	else if ((server_fd = cmusfm_server_bind(&saddr, &lock_fd)) == -1) {
+		if (lock_fd != -1)
+			close(lock_fd);
+		return -1;
+	}
 
-	ssize_t len = sizeof(struct cmusfm_data_record) +
-		record->off_location + strlen(location) + 1;
-	debug("Record length: %zd", len);
-	if (write(sock, buffer, len) != len)
-		goto fail;
+	if (cmusfm_loop_init() == -1) {
+		close(server_fd);
+		return -1;
+	}
 
-	return close(sock);
+	/* initialize scrobbling library */
+	sbs = scrobbler_initialize(config.service_api_url,
+			config.service_auth_url, SC_api_key, SC_secret);
+	scrobbler_set_session_key(sbs, config.session_key);
+	scrobbler_set_user_name(sbs, config.user_name);
+
+	cmusfm_server_compile_formats();
+	cmusfm_server_capture_open();
+	cmusfm_server_restore_state();
+
+	if (cmusfm_status_open() == -1)
+		debug("Couldn't create status board: %s", strerror(errno));
+	cache_queue = cmusfm_cache_count();
+
+	/* publish the state of the most recently updated session */
+	for (i = last = 0; i < sessions_len; i++)
+		if (sessions[i].updated > sessions[last].updated)
+			last = i;
+	status_board.status = CMSTATUS_STOPPED;
+	if (sessions_len > 0)
+		cmusfm_server_publish_status(&sessions[last],
+				(const struct cmusfm_data_record *)sessions[last].state.saved_data);
+	else
+		cmusfm_server_publish_status(NULL, NULL);
 
-fail:
-	err = errno;
-	close(sock);
-	errno = err;
-	return -1;
+	/* catch signals which are used to quit server */
+	cmusfm_loop_add_signal(SIGTERM, cmusfm_server_stop, NULL);
+	cmusfm_loop_add_signal(SIGHUP, cmusfm_server_stop, NULL);
+	cmusfm_loop_add_signal(SIGINT, cmusfm_server_stop, NULL);
+
+	cmusfm_loop_add_fd(server_fd, cmusfm_server_accept_cb, sbs);
+
+#if HAVE_SYS_INOTIFY_H
+	/* initialize inode notification to watch changes in the config file */
+	inotify_fd = inotify_init();
+	cmusfm_config_add_watch(inotify_fd);
+	cmusfm_loop_add_fd(inotify_fd, cmusfm_server_inotify_cb, NULL);
+#endif
+
+	cmusfm_server_idle_reset();
+	cmusfm_server_notify_manager("READY=1");
+
+	debug("Entering server main loop");
+	retval = cmusfm_loop_run();
+
+	cmusfm_server_notify_manager("STOPPING=1");
+	cmusfm_events_free();
+	cmusfm_status_close();
+
+	/* Process connections which are already queued. If the socket is owned
+	 * by the service manager, queued connections are left for the next
+	 * server instance. */
+	if (!activated) {
+		unlink(saddr.sun_path);
+		cmusfm_server_drain(server_fd, sbs);
+	}
+
+	/* submit the pending batch of deferred scrobbles */
+	if (config.scrobble_batch_interval != 0 && scrobbler_fail_time == 0 &&
+			(scrobble_batch_timer != -1 || cache_drain_timer != -1)) {
+		/* the event loop is not running, so requests have to wait */
+		scrobbler_set_rate_limit_wait(sbs, true);
+		cmusfm_cache_drain(sbs, &cache_drain_pos, SIZE_MAX);
+	}
+
+	if (inotify_fd != -1)
+		close(inotify_fd);
+#if ENABLE_LIBNOTIFY
+	cmusfm_notify_free();
+#endif
+	cmusfm_loop_free();
+	cmusfm_cache_close();
+	free_format_regexp(&format_localfile);
+	free_format_regexp(&format_shoutcast);
+	if (capture_fd != -1)
+		close(capture_fd);
+	scrobbler_free(sbs);
+	cmusfm_index_free();
+	close(server_fd);
+
+	if (!activated)
+		close(lock_fd);
+
+	return retval;
+}
+
+/* statistics of the running replay */
+static struct cmusfm_replay_stats *replay_stats;
+/* receive time of the replayed track record */
+static time_t replay_time;
+
+static time_t cmusfm_server_clock_replay(void) {
+	return replay_time;
+}
+
+/* Replay executor - the scrobbling service and the notification system
+ * are mocked, so only the requested actions are counted. */
+static void cmusfm_server_execute_replay(scrobbler_session_t *sbs,
+		const struct cmusfm_data_record *record, unsigned int actions,
+		const struct cmusfm_playstate_submit *submit) {
+	(void)sbs;
+	(void)record;
+	(void)submit;
+	if (actions & CMUSFM_PLAYSTATE_NOTIFY)
+		replay_stats->notifications++;
+	if (actions & CMUSFM_PLAYSTATE_NOWPLAYING)
+		replay_stats->nowplaying++;
+	if (actions & CMUSFM_PLAYSTATE_SCROBBLE)
+		replay_stats->scrobbled++;
+	if (actions & CMUSFM_PLAYSTATE_CACHE)
+		replay_stats->cached++;
+}
+
+/* Feed track records from the capture file into the server. Records are
+ * processed with the given speed factor relative to the original pace,
+ * where zero means as fast as possible. The scrobbling service is mocked,
+ * so the replay has no side effects, except the state file update (unless
+ * the state file is not set). Upon error -1 is returned. */
+int cmusfm_server_replay(const char *fname, double speed,
+		struct cmusfm_replay_stats *stats) {
+
+	struct cmusfm_capture_record header;
+	char session[128], record[CMSOCKET_BUFFER_SIZE];
+	struct timespec ts0, ts;
+	time_t first = 0;
+	double delay;
+	FILE *f;
+
+	memset(stats, 0, sizeof(*stats));
+
+	if ((f = fopen(fname, "r")) == NULL)
+		return -1;
+
+	replay_stats = stats;
+	cmusfm_server_executor = cmusfm_server_execute_replay;
+	cmusfm_server_set_clock(cmusfm_server_clock_replay);
+	scrobbler_fail_time = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	while (fread(&header, sizeof(header), 1, f) == 1) {
+
+		if (header.signature != CMUSFM_CAPTURE_SIGNATURE ||
+				header.len_session == 0 || header.len_session > sizeof(session) ||
+				header.len_record <= sizeof(struct cmusfm_data_record) ||
+				header.len_record > sizeof(record)) {
+			debug("Invalid capture record: %zu", stats->read);
+			stats->invalid++;
+			break;
+		}
+
+		memset(record, 0, sizeof(record));
+		if (fread(session, header.len_session, 1, f) != 1 ||
+				fread(record, header.len_record, 1, f) != 1) {
+			debug("Truncated capture record: %zu", stats->read);
+			stats->invalid++;
+			break;
+		}
+
+		stats->read++;
+		session[header.len_session - 1] = '\0';
+
+		if (!is_record_valid((struct cmusfm_data_record *)record, header.len_record)) {
+			debug("Invalid track record: %zu", stats->read);
+			stats->invalid++;
+			continue;
+		}
+
+		/* keep the pace of the original session */
+		if (first == 0)
+			first = header.timestamp;
+		if (speed > 0) {
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			delay = (header.timestamp - first) / speed -
+				(ts.tv_sec - ts0.tv_sec) - (ts.tv_nsec - ts0.tv_nsec) / 1e9;
+			if (delay > 0) {
+				ts.tv_sec = delay;
+				ts.tv_nsec = (delay - ts.tv_sec) * 1e9;
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		replay_time = header.timestamp;
+		cmusfm_server_process_data(NULL, cmusfm_server_get_session(session),
+				(struct cmusfm_data_record *)record);
+
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	stats->elapsed = (ts.tv_sec - ts0.tv_sec) + (ts.tv_nsec - ts0.tv_nsec) / 1e9;
+
+	cmusfm_server_executor = cmusfm_server_execute;
+	cmusfm_server_set_clock(NULL);
+	replay_stats = NULL;
+
+	fclose(f);
+	return 0;
 }
 
-/* Helper function for retrieving server socket file. */
-char *get_cmusfm_socket_file(void) {
-	return get_cmus_home_file(SOCKET_FNAME);
+/* Helper function for retrieving cmusfm state file. */
+char *get_cmusfm_state_file(void) {
+	return get_cmus_home_file(STATE_FNAME);
 }
@@ -11,12 +11,34 @@
 
 
 /* communication socket buffer size */
+#define CMSOCKET_MESSAGE_SIZE 4096
+/* track record buffer size */
 #define CMSOCKET_BUFFER_SIZE 1024
 
 /* shoutcast/stream flag for the status field */
 #define CMSTATUS_SHOUTCASTMASK 0xF0
 
-/* message queue record structure */
+enum cmusfm_message_type {
+	/* cmus status display program arguments */
+	CMMESSAGE_STATUS = 1,
+	/* subscription for the server events (no data) */
+	CMMESSAGE_SUBSCRIBE = 2,
+};
+
+/* client-server message structure */
+struct cmusfm_message {
+
+	uint8_t type;
+	uint8_t checksum;
+	uint16_t length;
+
+	/* NULL-separated key-value pairs
+	char data[];
+	*/
+
+};
+
+/* track record structure */
 struct cmusfm_data_record {
 
 	/* record header */
@@ -48,10 +70,48 @@ struct cmusfm_data_record {
 
 };
 
+/* "Cc" string (big-endian) at the beginning of the capture record */
+#define CMUSFM_CAPTURE_SIGNATURE 0x4363
+
+/* capture file record header structure */
+struct __attribute__((__packed__)) cmusfm_capture_record {
+
+	/* record header */
+	uint16_t signature;
+	uint16_t len_session;
+	uint16_t len_record;
+
+	/* receive time of the track record */
+	uint32_t timestamp;
+
+	/* NULL-terminated player session ID and the track record
+	char session[];
+	struct cmusfm_data_record record;
+	*/
+
+};
+
+/* statistics of the capture replay */
+struct cmusfm_replay_stats {
+	size_t read;
+	size_t invalid;
+	size_t notifications;
+	size_t nowplaying;
+	size_t scrobbled;
+	size_t cached;
+	/* wall-clock time of the replay in seconds */
+	double elapsed;
+};
+
 
 int cmusfm_server_check(void);
 int cmusfm_server_start(void);
-int cmusfm_server_send_track(struct cmtrack_info *tinfo);
+int cmusfm_server_send_status(int argc, char *argv[]);
+int cmusfm_server_subscribe(void);
+int cmusfm_server_replay(const char *fname, double speed,
+		struct cmusfm_replay_stats *stats);
+void cmusfm_server_set_clock(time_t (*clock)(void));
 char *get_cmusfm_socket_file(void);
+char *get_cmusfm_state_file(void);
 
 #endif  /* CMUSFM_SERVER_H_ */
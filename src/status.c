@@ -0,0 +1,177 @@
+/*
+ * cmusfm - status.c
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#if HAVE_CONFIG_H
+# include "../config.h"
+#endif
+
+#include "status.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cmusfm.h"
+#include "debug.h"
+
+
+/* The number of attempts to get the consistent status snapshot. */
+#define STATUS_LOAD_RETRIES 1000
+
+/* status board mapped by the server */
+static struct cmusfm_status *board = NULL;
+
+/* Get the name of the shared memory segment. The name is derived from the
+ * socket file location, so every server instance has its own board. */
+static void get_status_name(char *name, size_t size) {
+	uint64_t hash = make_fnv1a_hash_str(FNV1A_HASH_INIT, cmusfm_socket_file);
+	snprintf(name, size, "/cmusfm-%u-%016" PRIx64, (unsigned int)getuid(), hash);
+}
+
+/* Create the status board. Upon error -1 is returned. */
+int cmusfm_status_open(void) {
+
+	char name[64];
+	void *ptr;
+	int fd;
+
+	if (board != NULL)
+		return 0;
+
+	get_status_name(name, sizeof(name));
+	debug("Status board: %s", name);
+
+	if ((fd = shm_open(name, O_RDWR | O_CREAT, 0600)) == -1)
+		return -1;
+	if (ftruncate(fd, sizeof(*board)) == -1 ||
+			(ptr = mmap(NULL, sizeof(*board), PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		shm_unlink(name);
+		return -1;
+	}
+
+	close(fd);
+	board = ptr;
+
+	memset(board, 0, sizeof(*board));
+	memcpy(board->signature, "CMsb", sizeof(board->signature));
+	board->size = sizeof(*board);
+	board->pid = getpid();
+
+	return 0;
+}
+
+/* Publish the status on the board. Readers are not blocked by the writer,
+ * instead they retry when the sequence counter has changed during the
+ * read (or it was odd, which means that the update was in progress). */
+void cmusfm_status_publish(const struct cmusfm_status *status) {
+
+	uint32_t sequence;
+
+	if (board == NULL)
+		return;
+
+	sequence = board->sequence;
+	__atomic_store_n(&board->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	board->queue = status->queue;
+	board->updated = status->updated;
+	board->unpaused = status->unpaused;
+	board->playtime = status->playtime;
+	board->submit_playtime = status->submit_playtime;
+	board->duration = status->duration;
+	board->status = status->status;
+	board->online = status->online;
+	memcpy(board->artist, status->artist, sizeof(board->artist));
+	memcpy(board->album, status->album, sizeof(board->album));
+	memcpy(board->title, status->title, sizeof(board->title));
+
+	__atomic_store_n(&board->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+}
+
+/* Remove the status board. */
+void cmusfm_status_close(void) {
+
+	char name[64];
+
+	if (board == NULL)
+		return;
+
+	get_status_name(name, sizeof(name));
+	munmap(board, sizeof(*board));
+	shm_unlink(name);
+	board = NULL;
+
+}
+
+/* Map the status board published by the server. The mapping is valid even
+ * after the server exit, however it will not be updated anymore. Upon error
+ * NULL is returned. */
+const struct cmusfm_status *cmusfm_status_attach(void) {
+
+	char name[64];
+	struct stat st;
+	void *ptr;
+	int fd;
+
+	get_status_name(name, sizeof(name));
+	if ((fd = shm_open(name, O_RDONLY, 0)) == -1)
+		return NULL;
+
+	if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*board) ||
+			(ptr = mmap(NULL, sizeof(*board), PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	close(fd);
+	return ptr;
+}
+
+/* Load the consistent snapshot of the status board. This function does not
+ * use any system call, so it can be used for frequent polling. Upon error
+ * (e.g. incompatible board or the writer holding the board for too long)
+ * -1 is returned. */
+int cmusfm_status_load(const struct cmusfm_status *board, struct cmusfm_status *status) {
+
+	unsigned int retries = STATUS_LOAD_RETRIES;
+	uint32_t sequence;
+
+	if (memcmp(board->signature, "CMsb", sizeof(board->signature)) != 0 ||
+			board->size != sizeof(*board))
+		return -1;
+
+	while (retries--) {
+		sequence = __atomic_load_n(&board->sequence, __ATOMIC_ACQUIRE);
+		if (sequence % 2 == 1)
+			continue;
+		memcpy(status, board, sizeof(*status));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&board->sequence, __ATOMIC_RELAXED) == sequence)
+			return 0;
+	}
+
+	return -1;
+}
+
+/* Check whether the server which has published the status is still running.
+ * The board of the crashed server is not removed, so without this check the
+ * last status would be reported forever. */
+bool cmusfm_status_is_live(const struct cmusfm_status *status) {
+	if (status->pid <= 0)
+		return false;
+	return kill(status->pid, 0) == 0 || errno == EPERM;
+}
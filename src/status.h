@@ -0,0 +1,58 @@
+/*
+ * cmusfm - status.h
+ * SPDX-FileCopyrightText: 2014-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CMUSFM_STATUS_H_
+#define CMUSFM_STATUS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* status board structure - published by the server in the shared memory
+ * segment, so status bar widgets do not have to query the player */
+struct cmusfm_status {
+
+	/* "CMsb" string at the beginning of the segment */
+	char signature[4];
+	/* size of the status structure */
+	uint32_t size;
+	/* PID of the server which publishes the status */
+	int32_t pid;
+	/* sequence counter - odd while the status is being updated */
+	uint32_t sequence;
+	/* the (approximate) number of tracks in the offline cache */
+	uint32_t queue;
+
+	/* time of the last status change */
+	int64_t updated;
+	/* start of the current play period (valid while playing) */
+	int64_t unpaused;
+	/* play time accounted before the current play period */
+	uint32_t playtime;
+	/* play time required for scrobbling (0 - track will not be scrobbled) */
+	uint32_t submit_playtime;
+	uint16_t duration;
+	/* play status of the most recently updated player */
+	uint8_t status;
+	/* scrobbling service is available */
+	uint8_t online;
+
+	/* NULL-terminated track information */
+	char artist[128];
+	char album[128];
+	char title[256];
+
+};
+
+
+int cmusfm_status_open(void);
+void cmusfm_status_publish(const struct cmusfm_status *status);
+void cmusfm_status_close(void);
+const struct cmusfm_status *cmusfm_status_attach(void);
+int cmusfm_status_load(const struct cmusfm_status *board, struct cmusfm_status *status);
+bool cmusfm_status_is_live(const struct cmusfm_status *status);
+
+#endif  /* CMUSFM_STATUS_H_ */
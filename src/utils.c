@@ -10,7 +10,8 @@
 
 #include "cmusfm.h"
 
-#include <regex.h>
+#include <ctype.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -87,6 +88,26 @@ int mkdirp(const char *dir, mode_t mode) {
 	return mkdir(dir, mode);
 }
 
+/* Update the 64-bit FNV-1a hash with the given data. The initial value of
+ * the hash shall be FNV1A_HASH_INIT. */
+uint64_t make_fnv1a_hash(uint64_t hash, const void *data, size_t len) {
+	const unsigned char *p = data;
+	while (len--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+/* Update the 64-bit FNV-1a hash with the given string. The NULL string is
+ * treated as an empty one. */
+uint64_t make_fnv1a_hash_str(uint64_t hash, const char *str) {
+	if (str != NULL)
+		hash = make_fnv1a_hash(hash, str, strlen(str));
+	/* include the string terminator, so "ab" + "c" != "a" + "bc" */
+	return make_fnv1a_hash(hash, "\xff", 1);
+}
+
 /* Simple and fast "hashing" function. */
 int make_data_hash(const unsigned char *data, int len) {
 	int x, hash;
@@ -166,58 +187,180 @@ char *get_album_cover_file(const char *location, const char *format) {
 }
 #endif
 
-/* Get track information substrings from the given string. Matching is done
- * using the provided format string, which should be an ERE-based pattern with
- * customized placeholders. A placeholder is defined as a marked subexpression
- * with the ?X marker, where the X can be one the following characters:
+/* Check whether the given format is a simple one: two placeholders matching
+ * any characters (.+) separated with a literal string, optionally followed
+ * by the file name extension, e.g.: ^(?A.+) - (?T.+)\.[^.]+$ - and setup
+ * the fast-path matcher accordingly. Literal separator can not contain
+ * letters, because matching is case-insensitive. */
+static bool compile_format_fast_path(struct format_regexp *fmt, const char *format) {
+
+	const char *p = format;
+	size_t len = 0;
+
+	if (strncmp(p, "^(?", 3) != 0 || strncmp(&p[4], ".+)", 3) != 0)
+		return false;
+	fmt->types[0] = p[3];
+	p += 7;
+
+	while (*p != '(' && *p != '\0') {
+		if (*p == '\\' && p[1] != '\0' && strchr("\\^$.[]()*+?{}|", p[1]) != NULL)
+			p++;
+		else if (strchr("\\^$.[]()*+?{}|", *p) != NULL)
+			return false;
+		if (isalpha((unsigned char)*p) || len + 1 >= sizeof(fmt->separator))
+			return false;
+		fmt->separator[len++] = *p++;
+	}
+
+	if (len == 0 || strncmp(p, "(?", 2) != 0 || strncmp(&p[3], ".+)", 3) != 0)
+		return false;
+	fmt->types[1] = p[2];
+	p += 6;
+
+	if (strcmp(p, "\\.[^.]+$") == 0)
+		fmt->extension = true;
+	else if (strcmp(p, "$") != 0)
+		return false;
+
+	fmt->separator[len] = '\0';
+	fmt->separator_len = len;
+	return true;
+}
+
+/* Compile the format string used for getting track information substrings.
+ * The format should be an ERE-based pattern with customized placeholders.
+ * A placeholder is defined as a marked subexpression with the ?X marker,
+ * where the X can be one the following characters:
  *   A - artist, B - album, T - title, N - track number
  *   e.g.: ^(?A.+) - (?N[:digits:]+)\. (?T.+)$
- * In order to get a single match structure, one should use get_regexp_match()
- * function. When something goes wrong, NULL is returned. Memory for matches
- * is obtained with malloc(), and can be freed with free() function. */
-struct format_match *get_regexp_format_matches(const char *str, const char *format) {
-#define MATCHES_SIZE FORMAT_MATCH_TYPE_COUNT + 1
+ * Commonly used formats with a literal separator between two placeholders
+ * are matched without the regular expression engine. On success this
+ * function returns 0, otherwise -1 is returned. Compiled format has to be
+ * freed with the free_format_regexp() function. */
+int compile_format_regexp(struct format_regexp *fmt, const char *format) {
 
-	struct format_match *matches;
 	const char *p = format;
 	char *regexp;
 	int status, i = 0;
-	regex_t regex;
-	regmatch_t regmatch[MATCHES_SIZE];
-
-	debug("Matching: %s: %s", format, str);
 
-	/* allocate memory for up to FORMAT_MATCH_TYPE_COUNT matches
-	 * with one extra always empty terminating structure */
-	matches = (struct format_match *)calloc(MATCHES_SIZE, sizeof(*matches));
+	memset(fmt, 0, sizeof(*fmt));
 
 	regexp = strdup(format);
-	while (++i < MATCHES_SIZE && (p = strstr(p, "(?"))) {
+	while (++i < FORMAT_MATCH_TYPE_COUNT + 1 && (p = strstr(p, "(?"))) {
 		p += 3;
-		matches[i - 1].type = p[-1];
+		fmt->types[i - 1] = p[-1];
 		strcpy(&regexp[p - format - i * 2], p);
 	}
 
 	debug("Regexp: %s", regexp);
 
-	status = regcomp(&regex, regexp, REG_EXTENDED | REG_ICASE);
+	/* The regular expression is compiled regardless of the fast-path
+	 * matcher availability, so it can be used as a reference. */
+	status = regcomp(&fmt->regex, regexp, REG_EXTENDED | REG_ICASE);
 	free(regexp);
-	if (status) {
-		free(matches);
-		return NULL;
+	if (status)
+		return -1;
+
+	fmt->fast = compile_format_fast_path(fmt, format);
+	fmt->compiled = true;
+
+	debug("Fast-path matcher: %s", fmt->fast ? "yes" : "no");
+	return 0;
+}
+
+/* Free resources allocated by the compile_format_regexp() function. */
+void free_format_regexp(struct format_regexp *fmt) {
+	if (fmt->compiled)
+		regfree(&fmt->regex);
+	fmt->compiled = false;
+}
+
+/* Get track information substrings from the given string using the compiled
+ * format. The matches array shall be big enough to hold match structure for
+ * every possible placeholder with one extra always empty terminating
+ * structure. In order to get a single match structure, one should use
+ * get_regexp_match() function. On success this function returns 0,
+ * otherwise -1 is returned. */
+int get_format_matches(const struct format_regexp *fmt, const char *str,
+		struct format_match matches[FORMAT_MATCH_TYPE_COUNT + 1]) {
+#define MATCHES_SIZE FORMAT_MATCH_TYPE_COUNT + 1
+
+	regmatch_t regmatch[MATCHES_SIZE];
+	int i;
+
+	debug("Matching: %s", str);
+
+	if (!fmt->compiled)
+		return -1;
+
+	for (i = 0; i < MATCHES_SIZE; i++) {
+		matches[i].type = i < FORMAT_MATCH_TYPE_COUNT ? fmt->types[i] : 0;
+		matches[i].data = str;
+		matches[i].len = 0;
 	}
 
-	status = regexec(&regex, str, MATCHES_SIZE, regmatch, 0);
-	regfree(&regex);
-	if (status) {
-		free(matches);
-		return NULL;
+	if (fmt->fast) {
+
+		const char *sep = fmt->separator;
+		const size_t sep_len = fmt->separator_len;
+		const char *end = str + strlen(str);
+		const char *p, *last = NULL;
+
+		/* cut off the file name extension: \.[^.]+$ */
+		if (fmt->extension) {
+			if ((p = strrchr(str, '.')) == NULL || p + 1 == end)
+				return -1;
+			end = p;
+		}
+
+		/* Find the last occurrence of the separator, which leaves at least
+		 * one character for both placeholders - POSIX regular expression
+		 * matching rule: the leftmost subexpression is the longest one. */
+		if (end - str < (ptrdiff_t)sep_len + 2)
+			return -1;
+		for (p = str + 1; p < end - sep_len &&
+				(p = memchr(p, sep[0], end - sep_len - p)) != NULL; p++)
+			if (memcmp(p, sep, sep_len) == 0)
+				last = p;
+		if (last == NULL)
+			return -1;
+
+		matches[0].len = last - str;
+		matches[1].data = last + sep_len;
+		matches[1].len = end - matches[1].data;
+		return 0;
 	}
 
-	for (i = 1; i < MATCHES_SIZE; i++) {
-		matches[i - 1].data = &str[regmatch[i].rm_so];
-		matches[i - 1].len = regmatch[i].rm_eo - regmatch[i].rm_so;
+	if (regexec(&fmt->regex, str, MATCHES_SIZE, regmatch, 0))
+		return -1;
+
+	for (i = 1; i < MATCHES_SIZE; i++)
+		if (regmatch[i].rm_so != -1) {
+			matches[i - 1].data = &str[regmatch[i].rm_so];
+			matches[i - 1].len = regmatch[i].rm_eo - regmatch[i].rm_so;
+		}
+	return 0;
+}
+
+/* Get track information substrings from the given string. This function
+ * compiles the format upon every call, see compile_format_regexp() for the
+ * format description. When something goes wrong, NULL is returned. Memory
+ * for matches is obtained with malloc(), and can be freed with free(). */
+struct format_match *get_regexp_format_matches(const char *str, const char *format) {
+
+	struct format_match *matches;
+	struct format_regexp fmt;
+
+	if (compile_format_regexp(&fmt, format) == -1)
+		return NULL;
+
+	matches = (struct format_match *)calloc(MATCHES_SIZE, sizeof(*matches));
+	if (get_format_matches(&fmt, str, matches) == -1) {
+		free(matches);
+		matches = NULL;
 	}
+
+	free_format_regexp(&fmt);
 	return matches;
 }
 
@@ -0,0 +1,153 @@
+/*
+ * cmusfm - bench-cache.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "../src/cache.c"
+#include "../src/index.c"
+#include "../src/utils.c"
+#include "bench.inc"
+
+/* global variables used in the cache code */
+const char *cmusfm_cache_file;
+const char *cmusfm_index_file;
+struct cmusfm_config config;
+
+/* mock scrobbler with the invocation counter */
+int scrobbler_scrobble_count = 0;
+scrobbler_status_t scrobbler_scrobble(scrobbler_session_t *sbs, scrobbler_trackinfo_t *sbt) {
+	(void)sbs;
+	(void)sbt;
+	scrobbler_scrobble_count++;
+	return SCROBBLER_STATUS_OK;
+}
+
+/* mock batch scrobbler with the request and track counters */
+int scrobbler_scrobble_batch_count = 0;
+scrobbler_status_t scrobbler_scrobble_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, size_t count) {
+	(void)sbs;
+	(void)sbt;
+	scrobbler_scrobble_count += count;
+	scrobbler_scrobble_batch_count++;
+	return SCROBBLER_STATUS_OK;
+}
+
+/* mock listening history lookup - plays are never pending */
+scrobbler_status_t scrobbler_find_scrobble(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, bool *found) {
+	(void)sbs;
+	(void)sbt;
+	*found = false;
+	return SCROBBLER_STATUS_OK;
+}
+
+/* Generate a track with field lengths similar to the real-world ones. Tracks
+ * are played within the service acceptance window, ending at the given time. */
+static void bench_track_init(scrobbler_trackinfo_t *sbt, long i, time_t end) {
+
+	static char artist[64], album[128], track[128];
+	static char mbid[] = "b2181aae-5cba-496c-bb0c-b4cc0109ebf8";
+
+	snprintf(artist, sizeof(artist), "Artist %u", bench_random() % 2000);
+	snprintf(album, sizeof(album), "Album %u of the Artist (Remastered %u)",
+			bench_random() % 500, 1960 + bench_random() % 60);
+	snprintf(track, sizeof(track), "Track %u - %.*s", bench_random() % 20000,
+			(int)(bench_random() % 40), "The Quick Brown Fox Jumps Over The Lazy Dog");
+
+	sbt->timestamp = end - SCROBBLER_MAX_AGE / 2 + i % (SCROBBLER_MAX_AGE / 2);
+	sbt->artist = artist;
+	sbt->album_artist = bench_random() % 4 == 0 ? artist : NULL;
+	sbt->album = album;
+	sbt->track_number = 1 + bench_random() % 20;
+	sbt->track = track;
+	sbt->duration = 60 + bench_random() % 600;
+	sbt->mb_track_id = bench_random() % 2 == 0 ? mbid : NULL;
+
+}
+
+/* Measure the offline cache performance: append throughput, file size, the
+ * time needed to parse and submit all records and the peak memory usage.
+ * Drain time is estimated for the given service latency (in milliseconds)
+ * per every scrobble request (up to SCROBBLER_BATCH_SIZE tracks each).
+ * Append throughput depends on the cache sync mode (none, batch or always),
+ * which can be given as the third argument.
+ * Note, that the benchmark file is created in the current directory, so
+ * the sync cost depends on the underlying file system. */
+int main(int argc, char *argv[]) {
+
+	scrobbler_trackinfo_t sbt;
+	struct timespec ts0;
+	struct rusage usage;
+	struct stat st;
+	const char *mode = "batch";
+	long records = 100000;
+	double latency = 150;
+	double elapsed;
+	time_t now;
+	long i;
+
+	if (argc > 1)
+		records = atol(argv[1]);
+	if (argc > 2)
+		latency = atof(argv[2]);
+	if (argc > 3)
+		mode = argv[3];
+
+	if (strcmp(mode, "none") == 0)
+		config.cache_sync = CMUSFM_CACHE_SYNC_NONE;
+	else if (strcmp(mode, "batch") == 0)
+		config.cache_sync = CMUSFM_CACHE_SYNC_BATCH;
+	else if (strcmp(mode, "always") == 0)
+		config.cache_sync = CMUSFM_CACHE_SYNC_ALWAYS;
+	else {
+		fprintf(stderr, "ERROR: Invalid sync mode: %s\n", mode);
+		return EXIT_FAILURE;
+	}
+
+	cmusfm_cache_file = tempnam(".", "tmp-");
+	now = time(NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < records; i++) {
+		bench_track_init(&sbt, i, now);
+		cmusfm_cache_update(&sbt);
+	}
+	cmusfm_cache_close();
+	elapsed = bench_elapsed(&ts0);
+
+	if (stat(cmusfm_cache_file, &st) == -1) {
+		perror("ERROR: Stat cache file");
+		return EXIT_FAILURE;
+	}
+
+	printf("records: %ld\n", records);
+	printf("sync mode: %s\n", mode);
+	printf("append: %.3f s (%.0f records/s)\n", elapsed, records / elapsed);
+	printf("file size: %lld bytes (%.1f bytes/record)\n",
+			(long long)st.st_size, (double)st.st_size / records);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	cmusfm_cache_submit(NULL);
+	elapsed = bench_elapsed(&ts0);
+
+	printf("parse and submit: %.3f s (%.0f records/s)\n", elapsed, records / elapsed);
+	printf("submitted: %d (%d requests)\n", scrobbler_scrobble_count,
+			scrobbler_scrobble_batch_count);
+	printf("estimated drain time: %.1f s (%g ms per request)\n",
+			elapsed + scrobbler_scrobble_batch_count * latency / 1000, latency);
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("peak RSS: %ld kB\n", usage.ru_maxrss);
+
+	unlink(cmusfm_cache_file);
+	return EXIT_SUCCESS;
+}
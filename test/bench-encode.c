@@ -0,0 +1,122 @@
+/*
+ * cmusfm - bench-encode.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/libscrobbler2.c"
+#include "bench.inc"
+
+/* Generate track metadata similar to the ones found in real-world tags. */
+static char *bench_string(void) {
+
+	static const char *words[] = {
+		"The", "Beatles", "Yellow", "Submarine", "Love", "Me", "Do", "AC/DC",
+		"Sigur Rós", "Live", "Remastered", "2009", "feat.", "Part", "II", "&",
+		"Mr.", "Night", "Day", "Pink", "Floyd", "Björk", "(Demo)", "Vol. 2" };
+	char str[256] = "";
+	unsigned int i, n;
+
+	n = 1 + bench_random() % 5;
+	for (i = 0; i < n; i++)
+		strcat(strcat(str, i ? " " : ""), words[bench_random() % 24]);
+
+	return strdup(str);
+}
+
+/* Request string encoder based on the curl_easy_escape() function. */
+static char *bench_curl_request_string(CURL *curl,
+		const struct sb_request_data *sb_data, size_t sb_request_elements,
+		char *dest, size_t dest_size) {
+
+	char *escaped_data;
+	size_t i, offset = 0;
+
+	for (i = 0; i < sb_request_elements; i++) {
+		switch (sb_data[i].type) {
+		case SB_REQUEST_DATA_TYPE_NUMBER:
+			if (sb_data[i].value.n == 0)
+				continue;
+			offset += snprintf(&dest[offset], dest_size - offset,
+					"%s=%lu&", sb_data[i].name, sb_data[i].value.n);
+			break;
+		case SB_REQUEST_DATA_TYPE_STRING:
+			if (sb_data[i].value.s == NULL)
+				continue;
+			escaped_data = curl_easy_escape(curl, sb_data[i].value.s, 0);
+			offset += snprintf(&dest[offset], dest_size - offset,
+					"%s=%s&", sb_data[i].name, escaped_data);
+			curl_free(escaped_data);
+			break;
+		}
+	}
+
+	dest[offset - 1] = '\0';
+	return dest;
+}
+
+/* Compare the request string construction performance of the curl based
+ * encoder and the table-driven one. Every request contains the data of
+ * the full batch of tracks (6 string fields per track). The number of
+ * requests can be given as the first argument (default: 10k). */
+int main(int argc, char *argv[]) {
+
+	scrobbler_session_t sbs = { .session_key = "0123456789abcdef0123456789abcdef" };
+	struct sb_request_data sb_data[SCROBBLER_BATCH_SIZE * 8];
+	char names[ARRAYSIZE(sb_data)][24];
+	size_t i, n = 0, size, count = 10000;
+	char *buffer1, *buffer2;
+	struct timespec ts0;
+	double elapsed;
+	CURL *curl;
+
+	if (argc > 1)
+		count = atoi(argv[1]);
+
+	for (i = 0; i < SCROBBLER_BATCH_SIZE * 6; i++, n++) {
+		snprintf(names[n], sizeof(*names), "field[%zu]", i);
+		sb_data[n] = (struct sb_request_data){ names[n],
+			SB_REQUEST_DATA_TYPE_STRING, { .s = bench_string() } };
+	}
+	for (i = 0; i < SCROBBLER_BATCH_SIZE * 2; i++, n++) {
+		snprintf(names[n], sizeof(*names), "number[%zu]", i);
+		sb_data[n] = (struct sb_request_data){ names[n],
+			SB_REQUEST_DATA_TYPE_NUMBER, { .n = 1444444444 + i } };
+	}
+
+	size = sb_get_request_string_size(sb_data, n);
+	buffer1 = malloc(size);
+	buffer2 = malloc(size);
+	curl = curl_easy_init();
+
+	/* make sure that both encoders give the same results */
+	bench_curl_request_string(curl, sb_data, n, buffer1, size);
+	sb_make_curl_request_string(&sbs, sb_data, n, buffer2, size);
+	assert(strcmp(buffer1, buffer2) == 0);
+	printf("request: %zu elements, %zu bytes\n", n, strlen(buffer2));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < count; i++)
+		bench_curl_request_string(curl, sb_data, n, buffer1, size);
+	elapsed = bench_elapsed(&ts0);
+	printf("curl_easy_escape: %.3f s (%.0f requests/s)\n", elapsed, count / elapsed);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < count; i++)
+		sb_make_curl_request_string(&sbs, sb_data, n, buffer2, size);
+	elapsed = bench_elapsed(&ts0);
+	printf("table-driven: %.3f s (%.0f requests/s)\n", elapsed, count / elapsed);
+
+	curl_easy_cleanup(curl);
+	for (i = 0; i < SCROBBLER_BATCH_SIZE * 6; i++)
+		free((char *)sb_data[i].value.s);
+	free(buffer1);
+	free(buffer2);
+	return EXIT_SUCCESS;
+}
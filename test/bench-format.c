@@ -0,0 +1,136 @@
+/*
+ * cmusfm - bench-format.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/utils.c"
+#include "bench.inc"
+
+/* Generate file name similar to the ones found in real-world collections. */
+static char *bench_file_name(void) {
+
+	static const char *words[] = {
+		"The", "Beatles", "Yellow", "Submarine", "Love", "Me", "Do", "AC/DC",
+		"Sigur Rós", "Live", "Remastered", "2009", "feat.", "Part", "II", "-",
+		"Mr.", "Night", "Day", "Pink", "Floyd", "Björk", "(Demo)", "Vol. 2" };
+	static const char *exts[] = { "ogg", "mp3", "flac", "opus", "m4a" };
+	char name[256] = "";
+	unsigned int i, n;
+
+	n = 1 + bench_random() % 4;
+	for (i = 0; i < n; i++)
+		strcat(strcat(name, i ? " " : ""), words[bench_random() % 24]);
+	strcat(name, " - ");
+	n = 1 + bench_random() % 6;
+	for (i = 0; i < n; i++)
+		strcat(strcat(name, i ? " " : ""), words[bench_random() % 24]);
+	if (bench_random() % 50 == 0)
+		/* some names do not match the format at all */
+		strcpy(name, words[bench_random() % 24]);
+	strcat(strcat(name, "."), exts[bench_random() % 5]);
+
+	return strdup(name);
+}
+
+/* Compare the file name matching performance of the regular expression
+ * engine and the fast-path matcher. The corpus of file names can be read
+ * from the given file (one name per line), e.g.:
+ *   find ~/Music -type f -printf '%f\n' > corpus.txt
+ * otherwise 100k file names are generated. */
+int main(int argc, char *argv[]) {
+
+	const char *format = "^(?A.+) - (?T.+)\\.[^.]+$";
+	struct format_match m1[FORMAT_MATCH_TYPE_COUNT + 1];
+	struct format_match m2[FORMAT_MATCH_TYPE_COUNT + 1];
+	struct format_match *matches;
+	struct format_regexp fmt;
+	struct timespec ts0;
+	char **corpus = NULL;
+	size_t i, count = 0;
+	size_t matched = 0;
+	double elapsed;
+
+	if (argc > 2)
+		format = argv[2];
+
+	if (argc > 1) {
+		char line[1024];
+		FILE *f;
+		if ((f = fopen(argv[1], "r")) == NULL) {
+			perror("ERROR: Open corpus");
+			return EXIT_FAILURE;
+		}
+		while (fgets(line, sizeof(line), f) != NULL) {
+			line[strcspn(line, "\n")] = '\0';
+			corpus = realloc(corpus, (count + 1) * sizeof(*corpus));
+			corpus[count++] = strdup(line);
+		}
+		fclose(f);
+	}
+	else {
+		corpus = malloc(100000 * sizeof(*corpus));
+		for (count = 0; count < 100000; count++)
+			corpus[count] = bench_file_name();
+	}
+
+	if (compile_format_regexp(&fmt, format) == -1) {
+		fprintf(stderr, "ERROR: Invalid format: %s\n", format);
+		return EXIT_FAILURE;
+	}
+
+	printf("corpus: %zu file names\n", count);
+	printf("format: %s (fast-path: %s)\n", format, fmt.fast ? "yes" : "no");
+
+	/* make sure that both matchers give the same results */
+	for (i = 0; i < count; i++) {
+		bool fast = fmt.fast;
+		fmt.fast = false;
+		int rv1 = get_format_matches(&fmt, corpus[i], m1);
+		fmt.fast = fast;
+		int rv2 = get_format_matches(&fmt, corpus[i], m2);
+		assert(rv1 == rv2);
+		if (rv1 == 0) {
+			size_t j;
+			for (j = 0; j < FORMAT_MATCH_TYPE_COUNT; j++) {
+				assert(m1[j].type == m2[j].type);
+				assert(m1[j].len == m2[j].len);
+				assert(m1[j].len == 0 || m1[j].data == m2[j].data);
+			}
+		}
+		matched += rv1 == 0;
+	}
+
+	printf("matched: %zu\n", matched);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < count; i++)
+		if ((matches = get_regexp_format_matches(corpus[i], format)) != NULL)
+			free(matches);
+	elapsed = bench_elapsed(&ts0);
+	printf("regexp (compiled per call): %.3f s (%.0f names/s)\n", elapsed, count / elapsed);
+
+	bool fast = fmt.fast;
+	fmt.fast = false;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < count; i++)
+		get_format_matches(&fmt, corpus[i], m1);
+	elapsed = bench_elapsed(&ts0);
+	printf("regexp (precompiled): %.3f s (%.0f names/s)\n", elapsed, count / elapsed);
+
+	fmt.fast = fast;
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+	for (i = 0; i < count; i++)
+		get_format_matches(&fmt, corpus[i], m1);
+	elapsed = bench_elapsed(&ts0);
+	printf("fast-path: %.3f s (%.0f names/s)\n", elapsed, count / elapsed);
+
+	free_format_regexp(&fmt);
+	return EXIT_SUCCESS;
+}
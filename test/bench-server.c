@@ -0,0 +1,126 @@
+/*
+ * cmusfm - bench-server.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEBUG_SKIP_HICCUP
+#include "test-server.inc"
+#include "bench.inc"
+
+#define TRACKS_COUNT 64
+
+static void bench_track_init(struct cmusfm_data_record *track, int i) {
+
+	track->off_artist = 20;
+	track->off_album_artist = 60;
+	track->off_album = 100;
+	track->off_title = 140;
+	track->off_location = 180;
+
+	strcpy(((char *)(track + 1)), "");
+	sprintf(((char *)(track + 1)) + track->off_artist, "Artist %d", i % 7);
+	strcpy(((char *)(track + 1)) + track->off_album_artist, "");
+	sprintf(((char *)(track + 1)) + track->off_album, "Album %d", i % 5);
+	sprintf(((char *)(track + 1)) + track->off_title, "Title %d", i);
+	sprintf(((char *)(track + 1)) + track->off_location, "/music/%d.ogg", i);
+
+	track->track_number = i;
+	track->duration = 20 + bench_random() % 600;
+
+}
+
+/* Replay a pseudo-random sequence of play/pause/stop/seek events using the
+ * simulated clock and report the play-state machine throughput. Events can
+ * be interleaved between the given number of players. The state machine is
+ * driven directly, so the cost of the actions execution is not included. */
+int main(int argc, char *argv[]) {
+
+	static char tracks[TRACKS_COUNT][CMSOCKET_BUFFER_SIZE];
+	struct cmusfm_data_record *players_track[SERVER_MAX_SESSIONS];
+	static struct cmusfm_playstate players_state[SERVER_MAX_SESSIONS];
+	struct cmusfm_playstate_submit submit;
+	struct cmusfm_data_record *track;
+	long scrobbles = 0, nowplaying = 0;
+	unsigned int actions;
+	struct timespec ts0;
+	long events = 1000000;
+	long players = 1;
+	long i, p;
+
+	if (argc > 1)
+		events = atol(argv[1]);
+	if (argc > 2)
+		players = atol(argv[2]);
+	if (players < 1 || players > SERVER_MAX_SESSIONS) {
+		fprintf(stderr, "ERROR: Invalid number of players: %ld\n", players);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < TRACKS_COUNT; i++)
+		bench_track_init((struct cmusfm_data_record *)tracks[i], i);
+
+	config.submit_localfile = true;
+	config.nowplaying_localfile = true;
+
+	time_t time_start = test_clock_time;
+	for (p = 0; p < players; p++) {
+		cmusfm_playstate_init(&players_state[p]);
+		players_track[p] = (struct cmusfm_data_record *)tracks[0];
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ts0);
+
+	for (i = 0; i < events; i++) {
+		p = i % players;
+		track = players_track[p];
+		switch (bench_random() % 20) {
+		default:  /* play next track */
+			track = (struct cmusfm_data_record *)tracks[bench_random() % TRACKS_COUNT];
+			track->status = CMSTATUS_PLAYING;
+			test_clock_time += bench_random() % (track->duration + 1);
+			break;
+		case 0:
+		case 1:
+		case 2:  /* pause current track */
+			track->status = CMSTATUS_PAUSED;
+			test_clock_time += bench_random() % 60;
+			break;
+		case 3:
+		case 4:
+		case 5:  /* unpause (or replay) current track */
+			track->status = CMSTATUS_PLAYING;
+			test_clock_time += bench_random() % 300;
+			break;
+		case 6:  /* seek within current track */
+			track->status = CMSTATUS_PLAYING;
+			test_clock_time += bench_random() % 30;
+			break;
+		case 7:  /* stop playback */
+			track->status = CMSTATUS_STOPPED;
+			test_clock_time += bench_random() % 3600;
+			break;
+		}
+		cmusfm_server_update_record_checksum(track);
+		actions = cmusfm_playstate_update(&players_state[p], &config, track,
+				test_clock_time, true, &submit);
+		if (actions & CMUSFM_PLAYSTATE_SCROBBLE)
+			scrobbles++;
+		if (actions & CMUSFM_PLAYSTATE_NOWPLAYING)
+			nowplaying++;
+		players_track[p] = track;
+	}
+
+	double elapsed = bench_elapsed(&ts0);
+	printf("events: %ld (players: %ld)\n", events, players);
+	printf("simulated time: %.1f days\n", (test_clock_time - time_start) / 86400.0);
+	printf("scrobbles: %ld\n", scrobbles);
+	printf("now-playing updates: %ld\n", nowplaying);
+	printf("elapsed: %.3f s (%.0f events/s)\n", elapsed, events / elapsed);
+
+	return EXIT_SUCCESS;
+}
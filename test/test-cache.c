@@ -7,19 +7,59 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "../src/cache.c"
+#include "../src/index.c"
 #include "../src/utils.c"
 
-/* global variable used in the cache code */
+/* global variables used in the cache code */
 const char *cmusfm_cache_file;
+const char *cmusfm_index_file;
+struct cmusfm_config config;
 
 /* library function used by the cache code */
 int scrobbler_scrobble_count = 0;
+/* the number of subsequent network failures and the failure status */
+int scrobbler_scrobble_failures = 0;
+scrobbler_status_t scrobbler_scrobble_failure_status = SCROBBLER_STATUS_ERR_CURLPERF;
 scrobbler_status_t scrobbler_scrobble(scrobbler_session_t *sbs, scrobbler_trackinfo_t *sbt) {
 	(void)sbs;
-	(void)sbt;
+	if (scrobbler_scrobble_failures > 0) {
+		scrobbler_scrobble_failures--;
+		return scrobbler_scrobble_failure_status;
+	}
 	scrobbler_scrobble_count++;
+	if (sbt->artist == NULL || sbt->track == NULL || sbt->timestamp == 0)
+		return SCROBBLER_STATUS_ERR_TRACKINF;
+	return SCROBBLER_STATUS_OK;
+}
+
+/* batch is delivered track by track, so the invocation counter counts
+ * tracks, and the number of requests is counted separately */
+int scrobbler_scrobble_batch_count = 0;
+scrobbler_status_t scrobbler_scrobble_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, size_t count) {
+	scrobbler_status_t status;
+	size_t i;
+	assert(count > 0 && count <= SCROBBLER_BATCH_SIZE);
+	for (i = 0; i < count; i++)
+		if ((status = scrobbler_scrobble(sbs, &sbt[i])) != SCROBBLER_STATUS_OK)
+			return status;
+	scrobbler_scrobble_batch_count++;
+	return SCROBBLER_STATUS_OK;
+}
+
+/* play sent without the response is looked up in the listening history */
+int scrobbler_find_scrobble_count = 0;
+bool scrobbler_find_scrobble_found = false;
+scrobbler_status_t scrobbler_find_scrobble(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, bool *found) {
+	(void)sbs;
+	(void)sbt;
+	scrobbler_find_scrobble_count++;
+	*found = scrobbler_find_scrobble_found;
 	return SCROBBLER_STATUS_OK;
 }
 
@@ -28,9 +68,18 @@ int main(void) {
 	FILE *f;
 	size_t size;
 	char buffer[512];
+	char corrupt_file[512];
+	char expired_file[512];
+	char long_name[6000];
+	struct cmusfm_cache_record *record;
+	size_t record_size;
+	struct stat st;
+	struct cmusfm_cache_position pos = { 0 };
+	scrobbler_session_t sbs_limited = { .errornum = SCROBBLER_API_ERR_LIMIT_EXCEDED };
 	int i;
 
 	cmusfm_cache_file = tempnam(".", "tmp-");
+	cmusfm_index_file = tempnam(".", "tmp-");
 
 	scrobbler_trackinfo_t track_null = { 0 };
 	scrobbler_trackinfo_t track_empty = {
@@ -61,19 +110,282 @@ int main(void) {
 	assert(make_data_hash((unsigned char *)buffer, size) == 856388);
 	fclose(f);
 
+	/* records outside the service acceptance window are not submitted */
 	cmusfm_cache_submit(NULL);
-	assert(scrobbler_scrobble_count == 3);
+	assert(scrobbler_scrobble_count == 0);
 
 	/* cache file should have been removed after the submission */
 	assert(fopen(cmusfm_cache_file, "r") == NULL);
 
+	sprintf(expired_file, "%s.expired", cmusfm_cache_file);
+	assert(stat(expired_file, &st) == 0);
+	assert(st.st_size == 158);
+	unlink(expired_file);
+
+	track_full.timestamp = time(NULL) - 3600;
+
 	/* test for big cache file - multiple read calls */
 
-	for (i = 500; i != 0; i--)
+	for (i = 500; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+
+	cmusfm_cache_submit(NULL);
+	assert(scrobbler_scrobble_count == 500);
+	/* tracks are submitted in batches */
+	assert(scrobbler_scrobble_batch_count == 500 / SCROBBLER_BATCH_SIZE);
+
+	/* test for record larger than the read buffer */
+
+	memset(long_name, 'x', sizeof(long_name) - 1);
+	long_name[sizeof(long_name) - 1] = '\0';
+	track_full.artist = long_name;
+	cmusfm_cache_update(&track_full);
+	track_full.artist = "The Beatles";
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+
+	cmusfm_cache_submit(NULL);
+	assert(scrobbler_scrobble_count == 502);
+
+	/* test for corrupted cache file - damaged records are moved to the
+	 * quarantine file and valid records are submitted */
+
+	record = get_cache_record(&track_full);
+	record_size = get_cache_record_size(record);
+
+	for (i = 4; i != 0; i--) {
+		track_full.timestamp++;
 		cmusfm_cache_update(&track_full);
+	}
+
+	assert((f = fopen(cmusfm_cache_file, "r+")) != NULL);
+	/* damage data of the second record */
+	fseek(f, record_size + 30, SEEK_SET);
+	fputc('X', f);
+	/* damage header of the third record */
+	fseek(f, 2 * record_size + 10, SEEK_SET);
+	fputc(0xFF, f);
+	fclose(f);
+	/* simulate partial write of the last record */
+	assert(truncate(cmusfm_cache_file, 4 * record_size - 10) == 0);
 
 	cmusfm_cache_submit(NULL);
 	assert(scrobbler_scrobble_count == 503);
 
+	sprintf(corrupt_file, "%s.corrupt", cmusfm_cache_file);
+	assert(stat(corrupt_file, &st) == 0);
+	assert((size_t)st.st_size == 3 * record_size - 10);
+	unlink(corrupt_file);
+
+	/* test for garbage in front of valid records */
+
+	assert((f = fopen(cmusfm_cache_file, "w")) != NULL);
+	fputs("Cr garbage CCC", f);
+	fclose(f);
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+
+	cmusfm_cache_submit(NULL);
+	assert(scrobbler_scrobble_count == 504);
+
+	assert(stat(corrupt_file, &st) == 0);
+	assert(st.st_size == 14);
+	unlink(corrupt_file);
+
+	/* test for already submitted tracks - e.g. the response to the
+	 * scrobble request has been lost, so the track was cached */
+
+	cmusfm_cache_update(&track_full);
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+
+	cmusfm_cache_submit(NULL);
+	assert(scrobbler_scrobble_count == 505);
+
+	/* test for incremental submission - drain can be resumed from the
+	 * returned offset, also after the network failure */
+
+	for (i = 5; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+
+	assert(cmusfm_cache_drain(NULL, &pos, 2) == 1);
+	assert(scrobbler_scrobble_count == 507);
+	assert(pos.offset == (long)(2 * record_size));
+
+	scrobbler_scrobble_failures = 1;
+	assert(cmusfm_cache_drain(NULL, &pos, 2) == -1);
+	assert(scrobbler_scrobble_count == 507);
+	assert(pos.offset == (long)(2 * record_size));
+
+	/* batch sent without the response might have not been delivered, so
+	 * it is kept in the cache (and not indexed) for the resubmission */
+	scrobbler_scrobble_failures = 1;
+	scrobbler_scrobble_failure_status = SCROBBLER_STATUS_ERR_NORESPONSE;
+	assert(cmusfm_cache_drain(NULL, &pos, 2) == -1);
+	assert(pos.offset == (long)(2 * record_size));
+	assert(scrobbler_find_scrobble_count == 0);
+
+	/* batch rejected by the service rate limit is resubmitted later, but the
+	 * failure is reported separately - the service is available */
+	scrobbler_scrobble_failures = 1;
+	scrobbler_scrobble_failure_status = SCROBBLER_STATUS_ERR_SCROBAPI;
+	assert(cmusfm_cache_drain(&sbs_limited, &pos, 2) == -2);
+	assert(pos.offset == (long)(2 * record_size));
+	scrobbler_scrobble_failure_status = SCROBBLER_STATUS_ERR_CURLPERF;
+
+	/* pending tracks not found in the listening history are resubmitted */
+	assert(cmusfm_cache_drain(NULL, &pos, 2) == 1);
+	assert(scrobbler_find_scrobble_count == 2);
+	assert(cmusfm_cache_drain(NULL, &pos, 2) == 0);
+	assert(scrobbler_find_scrobble_count == 2);
+	assert(scrobbler_scrobble_count == 510);
+	assert(pos.offset == 0);
+	assert(fopen(cmusfm_cache_file, "r") == NULL);
+
+	/* test for the group commit - records are synchronized in batches */
+
+	config.cache_sync = CMUSFM_CACHE_SYNC_BATCH;
+	for (i = CACHE_SYNC_BATCH - 1; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+	assert(writer.pending == CACHE_SYNC_BATCH - 1);
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+	assert(writer.pending == 0);
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+	assert(writer.pending == 1);
+	cmusfm_cache_sync();
+	assert(writer.pending == 0);
+
+	config.cache_sync = CMUSFM_CACHE_SYNC_ALWAYS;
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+	assert(writer.pending == 0);
+	cmusfm_cache_close();
+	assert(writer.fd == -1);
+
+	assert(stat(cmusfm_cache_file, &st) == 0);
+	assert((size_t)st.st_size == (CACHE_SYNC_BATCH + 2) * record_size);
+	cmusfm_cache_submit(NULL);
+	assert(scrobbler_scrobble_count == 510 + CACHE_SYNC_BATCH + 2);
+	config.cache_sync = CMUSFM_CACHE_SYNC_NONE;
+
+	/* test for the record quota - the oldest records are removed, so the
+	 * cache fits in 3/4 of the quota */
+
+	config.cache_max_records = 8;
+	for (i = 9; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+	assert(cache_count_records() == 6);
+	assert(stat(cmusfm_cache_file, &st) == 0);
+	assert((size_t)st.st_size == 6 * record_size);
+
+	/* drain position is not valid for the compacted file */
+	assert(cmusfm_cache_drain(NULL, &pos, 2) == 1);
+	for (i = 3; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+	assert(cache_count_records() == 6);
+	assert(cmusfm_cache_drain(NULL, &pos, SIZE_MAX) == 0);
+	assert(scrobbler_scrobble_count == 528 + 2 + 6);
+	config.cache_max_records = 0;
+
+	/* test for the size quota - expired records are removed as well */
+
+	config.cache_max_size = 10 * record_size;
+	track_full.timestamp -= SCROBBLER_MAX_AGE + 60;
+	cmusfm_cache_update(&track_full);
+	track_full.timestamp += SCROBBLER_MAX_AGE + 60;
+	for (i = 10; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+	assert(stat(cmusfm_cache_file, &st) == 0);
+	assert((size_t)st.st_size == 7 * record_size);
+	assert(stat(expired_file, &st) == 0);
+	assert((size_t)st.st_size == record_size);
+	unlink(expired_file);
+	config.cache_max_size = 0;
+
+	cmusfm_cache_submit(NULL);
+	assert(scrobbler_scrobble_count == 536 + 7);
+
+	/* pending tracks recorded by the service are not resubmitted */
+	for (i = 3; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+	scrobbler_scrobble_failures = 1;
+	scrobbler_scrobble_failure_status = SCROBBLER_STATUS_ERR_NORESPONSE;
+	assert(cmusfm_cache_drain(NULL, &pos, SIZE_MAX) == -1);
+	scrobbler_scrobble_failure_status = SCROBBLER_STATUS_ERR_CURLPERF;
+	scrobbler_find_scrobble_found = true;
+	assert(cmusfm_cache_drain(NULL, &pos, SIZE_MAX) == 0);
+	assert(scrobbler_find_scrobble_count == 2 + 3);
+	assert(scrobbler_scrobble_count == 536 + 7);
+	assert(cmusfm_index_contains(&track_full));
+
+	/* test for the failed compaction - it is not retried upon every update */
+
+	snprintf(buffer, sizeof(buffer), "%s.tmp", cmusfm_cache_file);
+	assert(mkdir(buffer, 0700) == 0);
+	config.cache_max_records = 8;
+	for (i = 9; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+	assert(cache_count_records() == 9);
+	assert(writer.compact_failed != 0);
+	rmdir(buffer);
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+	assert(cache_count_records() == 10);
+	/* compaction is retried after the retry delay */
+	writer.compact_failed -= CACHE_COMPACT_RETRY_DELAY;
+	track_full.timestamp++;
+	cmusfm_cache_update(&track_full);
+	assert(cache_count_records() == 6);
+	assert(writer.compact_failed == 0);
+	assert(cmusfm_cache_drain(NULL, &pos, SIZE_MAX) == 0);
+	assert(scrobbler_scrobble_count == 543 + 6);
+	config.cache_max_records = 0;
+
+	/* test for the drain resumed before the damaged record - damaged data
+	 * shall be moved to the quarantine file only once */
+
+	for (i = 3; i != 0; i--) {
+		track_full.timestamp++;
+		cmusfm_cache_update(&track_full);
+	}
+	assert((f = fopen(cmusfm_cache_file, "r+")) != NULL);
+	fseek(f, record_size + 30, SEEK_SET);
+	fputc('X', f);
+	fclose(f);
+	scrobbler_scrobble_failures = 1;
+	assert(cmusfm_cache_drain(NULL, &pos, SIZE_MAX) == -1);
+	assert(pos.offset == 0);
+	assert(stat(corrupt_file, &st) == 0);
+	assert((size_t)st.st_size == record_size);
+	assert(cmusfm_cache_drain(NULL, &pos, SIZE_MAX) == 0);
+	assert(scrobbler_scrobble_count == 549 + 2);
+	assert(stat(corrupt_file, &st) == 0);
+	assert((size_t)st.st_size == record_size);
+	unlink(corrupt_file);
+
+	/* the index of submitted tracks shall be persistent */
+	cmusfm_index_free();
+	assert(cmusfm_index_contains(&track_full));
+	cmusfm_index_free();
+	unlink(cmusfm_index_file);
+
 	return EXIT_SUCCESS;
 }
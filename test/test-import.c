@@ -0,0 +1,203 @@
+/*
+ * cmusfm - test-import.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/cache.c"
+#include "../src/import.c"
+#include "../src/index.c"
+#include "../src/utils.c"
+
+/* global variables used in the import code */
+const char *cmusfm_cache_file;
+const char *cmusfm_index_file;
+struct cmusfm_config config;
+
+/* mock service availability - the status of every service request */
+scrobbler_status_t scrobbler_service_status = SCROBBLER_STATUS_OK;
+
+scrobbler_status_t scrobbler_scrobble(scrobbler_session_t *sbs, scrobbler_trackinfo_t *sbt) {
+	(void)sbs;
+	(void)sbt;
+	return scrobbler_service_status;
+}
+
+/* mock batch scrobbler with the request and track counters */
+int scrobbler_scrobble_batch_count = 0;
+int scrobbler_scrobble_count = 0;
+scrobbler_status_t scrobbler_scrobble_batch(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, size_t count) {
+	(void)sbs;
+	(void)sbt;
+	assert(count > 0 && count <= SCROBBLER_BATCH_SIZE);
+	scrobbler_scrobble_batch_count++;
+	if (scrobbler_service_status == SCROBBLER_STATUS_OK)
+		scrobbler_scrobble_count += count;
+	return scrobbler_service_status;
+}
+
+/* mock listening history lookup - plays are never pending */
+scrobbler_status_t scrobbler_find_scrobble(scrobbler_session_t *sbs,
+		scrobbler_trackinfo_t *sbt, bool *found) {
+	(void)sbs;
+	(void)sbt;
+	*found = false;
+	return SCROBBLER_STATUS_OK;
+}
+
+const char *scrobbler_strerror(scrobbler_session_t *sbs) {
+	(void)sbs;
+	return "Mocked error";
+}
+
+/* Parse the JSON line stored in the writable buffer. */
+static int test_parse_json(const char *line, scrobbler_trackinfo_t *sbt) {
+	static char buffer[512];
+	strcpy(buffer, line);
+	memset(sbt, 0, sizeof(*sbt));
+	return import_parse_json(buffer, sbt);
+}
+
+/* Import plays from the given content written to the temporary file. */
+static int test_import(const char *content, struct cmusfm_import_stats *stats) {
+
+	char *fname = tempnam(".", "tmp-");
+	FILE *f;
+	int rv;
+
+	assert((f = fopen(fname, "w")) != NULL);
+	fputs(content, f);
+	fclose(f);
+
+	rv = cmusfm_import(NULL, fname, stats);
+
+	unlink(fname);
+	free(fname);
+	return rv;
+}
+
+int main(void) {
+
+	struct cmusfm_import_stats stats;
+	scrobbler_trackinfo_t sbt;
+	char buffer[4096];
+	char line[512];
+	time_t now = time(NULL);
+	int i;
+
+	cmusfm_cache_file = tempnam(".", "tmp-");
+	cmusfm_index_file = tempnam(".", "tmp-");
+
+	/* Rockbox scrobbler log - skipped tracks are not imported */
+	strcpy(line, "The Beatles\tRevolver\tYellow Submarine\t6\t161\tL\t1444444444\tb2181aae");
+	memset(&sbt, 0, sizeof(sbt));
+	assert(import_parse_rockbox(line, &sbt) == 0);
+	assert(strcmp(sbt.artist, "The Beatles") == 0);
+	assert(strcmp(sbt.album, "Revolver") == 0);
+	assert(strcmp(sbt.track, "Yellow Submarine") == 0);
+	assert(sbt.track_number == 6);
+	assert(sbt.duration == 161);
+	assert(sbt.timestamp == 1444444444);
+	assert(strcmp(sbt.mb_track_id, "b2181aae") == 0);
+	strcpy(line, "The Beatles\tRevolver\tYellow Submarine\t6\t161\tS\t1444444444");
+	memset(&sbt, 0, sizeof(sbt));
+	assert(import_parse_rockbox(line, &sbt) == -1);
+
+	/* TSV with optional fields omitted */
+	strcpy(line, "1444444444\tThe Beatles\tYellow Submarine\t\tThe Beatles");
+	memset(&sbt, 0, sizeof(sbt));
+	assert(import_parse_tsv(line, &sbt) == 0);
+	assert(sbt.timestamp == 1444444444);
+	assert(strcmp(sbt.artist, "The Beatles") == 0);
+	assert(strcmp(sbt.track, "Yellow Submarine") == 0);
+	assert(sbt.album == NULL);
+	assert(strcmp(sbt.album_artist, "The Beatles") == 0);
+	assert(sbt.duration == 0);
+
+	/* JSON lines with alternative key names and escape sequences */
+	assert(test_parse_json("{\"timestamp\": 1444444444, \"artist\": \"The \\\"Beatles\\\"\", "
+				"\"title\": \"Yellow\\tSubmarine\", \"albumArtist\": \"Bj\\u00f6rk\", "
+				"\"trackNumber\": 6, \"duration\": 161, \"rating\": null}", &sbt) == 0);
+	assert(sbt.timestamp == 1444444444);
+	assert(strcmp(sbt.artist, "The \"Beatles\"") == 0);
+	assert(strcmp(sbt.track, "Yellow\tSubmarine") == 0);
+	assert(strcmp(sbt.album_artist, "Bj\xc3\xb6rk") == 0);
+	assert(sbt.track_number == 6);
+	assert(sbt.duration == 161);
+	/* UTF-16 surrogate pair is combined into a single code point */
+	assert(test_parse_json("{\"track\": \"\\ud83c\\udfb5\"}", &sbt) == 0);
+	assert(strcmp(sbt.track, "\xf0\x9f\x8e\xb5") == 0);
+
+	/* malformed JSON lines */
+	assert(test_parse_json("[\"The Beatles\"]", &sbt) == -1);
+	assert(test_parse_json("{\"artist\" \"The Beatles\"}", &sbt) == -1);
+	assert(test_parse_json("{\"artist\": \"The Beatles", &sbt) == -1);
+	assert(test_parse_json("{\"artist\": \"\\u00\"}", &sbt) == -1);
+	assert(test_parse_json("{\"artist\": \"\\u00g0\"}", &sbt) == -1);
+	assert(test_parse_json("{\"artist\": \"\\u", &sbt) == -1);
+	assert(test_parse_json("{\"artist\": \"\\ud83c\"}", &sbt) == -1);
+	assert(test_parse_json("{\"artist\": \"\\ud83c\\u0041\"}", &sbt) == -1);
+	assert(test_parse_json("{\"artist\": \"\\udfb5\"}", &sbt) == -1);
+
+	/* mixed formats, plays outside the acceptance window and duplicates */
+	snprintf(buffer, sizeof(buffer),
+			"# comment\n"
+			"%ld\tThe Beatles\tYellow Submarine\n"
+			"%ld\tThe Beatles\tYellow Submarine\n"
+			"%ld\tThe Beatles\tHelp!\n"
+			"{\"timestamp\": %ld, \"artist\": \"The Beatles\", \"track\": \"Help!\"}\n"
+			"1444444444\tThe Beatles\tYesterday\n"
+			"\n"
+			"%ld\tThe Beatles\n",
+			(long)now - 600, (long)now - 600, (long)now - 300, (long)now - 300,
+			(long)now - 100);
+	assert(test_import(buffer, &stats) == 0);
+	assert(stats.read == 6);
+	assert(stats.invalid == 1);
+	assert(stats.expired == 1);
+	assert(stats.duplicates == 2);
+	assert(stats.submitted == 2);
+	assert(stats.cached == 0);
+	assert(scrobbler_scrobble_batch_count == 1);
+	assert(scrobbler_scrobble_count == 2);
+
+	/* plays submitted previously are found in the index */
+	assert(test_import(buffer, &stats) == 0);
+	assert(stats.duplicates == 4);
+	assert(stats.submitted == 0);
+	assert(scrobbler_scrobble_batch_count == 1);
+
+	/* Rockbox log with the header - plays are submitted in batches */
+	strcpy(buffer, "#AUDIOSCROBBLER/1.1\n#TZ/UTC\n");
+	for (i = 0; i < SCROBBLER_BATCH_SIZE + 10; i++)
+		snprintf(&buffer[strlen(buffer)], sizeof(buffer) - strlen(buffer),
+				"Artist\t\tTitle %d\t\t\t%c\t%ld\t\n", i, i % 10 ? 'L' : 'S',
+				(long)now - 3600 + i);
+	assert(test_import(buffer, &stats) == 0);
+	assert(stats.read == SCROBBLER_BATCH_SIZE + 10);
+	assert(stats.invalid == 6);
+	assert(stats.submitted == SCROBBLER_BATCH_SIZE + 4);
+	assert(scrobbler_scrobble_batch_count == 3);
+
+	/* plays are cached upon the submission failure */
+	scrobbler_service_status = SCROBBLER_STATUS_ERR_CURLPERF;
+	snprintf(buffer, sizeof(buffer), "%ld\tThe Beatles\tGirl\n", (long)now - 60);
+	assert(test_import(buffer, &stats) == 0);
+	assert(stats.submitted == 0);
+	assert(stats.cached == 1);
+	assert(access(cmusfm_cache_file, F_OK) == 0);
+
+	/* non-existing input file */
+	assert(cmusfm_import(NULL, "non-existing-file", &stats) == -1);
+
+	unlink(cmusfm_cache_file);
+	unlink(cmusfm_index_file);
+	return EXIT_SUCCESS;
+}
@@ -4,7 +4,10 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#include <unistd.h>
+
 #include "../src/notify.c"
+#include "../src/utils.c"
 
 int main(void) {
 
@@ -40,6 +43,16 @@ int main(void) {
 	cmusfm_notify_show(&track_no_track, NULL);
 	sleep(1);
 
+	/* missing cover file shall not prevent notification */
+	cmusfm_notify_show(&track_full, "/nonexistent/folder.jpg");
+	sleep(1);
+
+	/* burst of notifications shall be coalesced */
+	cmusfm_notify_show(&track_full, NULL);
+	cmusfm_notify_show(&track_no_track, NULL);
+	cmusfm_notify_show(&track_full, NULL);
+	sleep(1);
+
 	cmusfm_notify_free();
 	return EXIT_SUCCESS;
 }
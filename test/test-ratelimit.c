@@ -0,0 +1,163 @@
+/*
+ * cmusfm - test-ratelimit.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+
+/* mock monotonic clock - time is advanced by the mocked sleep only */
+struct timespec test_clock_time = { .tv_sec = 1000 };
+static int test_clock_gettime(clockid_t id, struct timespec *ts) {
+	(void)id;
+	*ts = test_clock_time;
+	return 0;
+}
+
+static void test_clock_advance(double seconds) {
+	long nsec = test_clock_time.tv_nsec + (long)(seconds * 1e9 + 0.5);
+	test_clock_time.tv_sec += nsec / 1000000000;
+	test_clock_time.tv_nsec = nsec % 1000000000;
+}
+
+/* mock sleep - with the total sleep time and the number of interruptions
+ * which shall be simulated before the sleep is completed */
+double test_sleep_time = 0;
+int test_sleep_interrupts = 0;
+static int test_nanosleep(const struct timespec *req, struct timespec *rem) {
+	double seconds = req->tv_sec + req->tv_nsec / 1e9;
+	if (test_sleep_interrupts > 0) {
+		test_sleep_interrupts--;
+		/* half of the requested time has elapsed */
+		test_clock_advance(seconds / 2);
+		test_sleep_time += seconds / 2;
+		rem->tv_sec = (seconds / 2);
+		rem->tv_nsec = (seconds / 2 - rem->tv_sec) * 1e9;
+		errno = EINTR;
+		return -1;
+	}
+	test_clock_advance(seconds);
+	test_sleep_time += seconds;
+	return 0;
+}
+
+/* mock request - defined below, since it uses the library internals */
+static CURLcode test_curl_easy_perform(CURL *curl);
+
+#define clock_gettime test_clock_gettime
+#define nanosleep test_nanosleep
+#define curl_easy_perform test_curl_easy_perform
+#include "../src/libscrobbler2.c"
+
+/* mock request - with the number of rate limit errors which shall be
+ * returned before the request is accepted */
+struct sb_response_data *test_response = NULL;
+int test_perform_count = 0;
+int test_perform_rate_limit_errors = 0;
+static CURLcode test_curl_easy_perform(CURL *curl) {
+	const char *body = "<lfm status=\"ok\"></lfm>";
+	(void)curl;
+	if (test_perform_rate_limit_errors > 0) {
+		test_perform_rate_limit_errors--;
+		body = "<lfm status=\"failed\"><error code=\"29\">Rate Limit Exceeded</error></lfm>";
+	}
+	free(test_response->data);
+	test_response->data = strdup(body);
+	test_response->size = strlen(body);
+	test_perform_count++;
+	return CURLE_OK;
+}
+
+/* Perform the request with the mocked response. */
+static scrobbler_status_t test_perform(scrobbler_session_t *sbs, bool paced) {
+	struct sb_response_data response = { 0 };
+	test_response = &response;
+	sb_curl_perform(NULL, &response, sbs, paced);
+	free(response.data);
+	return sbs->status;
+}
+
+int main(void) {
+
+	uint8_t key[16] = { 0 };
+	scrobbler_session_t *sbs;
+	double rate;
+	int i;
+
+	assert((sbs = scrobbler_initialize("", "", key, key)) != NULL);
+
+	/* requests are sent immediately up to the bucket size */
+	for (i = 0; i < SB_RATE_BURST; i++)
+		assert(test_perform(sbs, true) == SCROBBLER_STATUS_OK);
+	assert(test_sleep_time == 0);
+
+	/* the next token is available after the refill period */
+	assert(scrobbler_get_rate_limit_delay(sbs) == 200);
+	test_clock_advance(0.1);
+	assert(scrobbler_get_rate_limit_delay(sbs) == 100);
+	test_clock_advance(0.1);
+	assert(scrobbler_get_rate_limit_delay(sbs) == 0);
+	assert(test_perform(sbs, true) == SCROBBLER_STATUS_OK);
+
+	/* by default the session does not wait for the token - the token is
+	 * borrowed, so the next one is available after two refill periods */
+	assert(test_perform(sbs, true) == SCROBBLER_STATUS_OK);
+	assert(test_sleep_time == 0);
+	assert(scrobbler_get_rate_limit_delay(sbs) == 400);
+
+	/* waiting session sleeps until the token is available, even if the
+	 * sleep is interrupted by a signal */
+	scrobbler_set_rate_limit_wait(sbs, true);
+	test_sleep_interrupts = 1;
+	assert(test_perform(sbs, true) == SCROBBLER_STATUS_OK);
+	assert(test_sleep_interrupts == 0);
+	assert(test_sleep_time > 0.399 && test_sleep_time < 0.401);
+
+	/* unpaced requests (e.g. authentication) neither wait nor take tokens */
+	test_sleep_time = 0;
+	for (i = 0; i < 10; i++)
+		assert(test_perform(sbs, false) == SCROBBLER_STATUS_OK);
+	assert(test_sleep_time == 0);
+	assert(scrobbler_get_rate_limit_delay(sbs) == 200);
+
+	/* upon the rate limit error the request rate is halved, and the request
+	 * is retried after the back-off by the waiting session */
+	test_clock_advance(10);
+	test_perform_count = 0;
+	test_perform_rate_limit_errors = 1;
+	assert(test_perform(sbs, true) == SCROBBLER_STATUS_OK);
+	assert(test_perform_count == 2);
+	assert(test_sleep_time > 0.399 && test_sleep_time < 0.401);
+	assert(sbs->rate == SB_RATE_MAX / 2 + SB_RATE_INCREASE);
+
+	/* retries are limited */
+	rate = sbs->rate;
+	test_sleep_time = 0;
+	test_perform_count = 0;
+	test_perform_rate_limit_errors = 10;
+	assert(test_perform(sbs, true) == SCROBBLER_STATUS_ERR_SCROBAPI);
+	assert(sbs->errornum == SCROBBLER_API_ERR_LIMIT_EXCEDED);
+	assert(test_perform_count == 1 + SB_RATE_RETRIES);
+	assert(sbs->rate == rate / 8);
+
+	/* session which does not wait reports the error right away, and the
+	 * back-off is left to the caller */
+	scrobbler_set_rate_limit_wait(sbs, false);
+	test_clock_advance(60);
+	test_sleep_time = 0;
+	test_perform_count = 0;
+	test_perform_rate_limit_errors = 1;
+	assert(test_perform(sbs, true) == SCROBBLER_STATUS_ERR_SCROBAPI);
+	assert(test_perform_count == 1);
+	assert(test_sleep_time == 0);
+	assert(scrobbler_get_rate_limit_delay(sbs) == 5000);
+
+	scrobbler_free(sbs);
+	return EXIT_SUCCESS;
+}
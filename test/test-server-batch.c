@@ -0,0 +1,82 @@
+/*
+ * cmusfm - test-server-batch.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+
+#define DEBUG_SKIP_HICCUP
+#include "test-server.inc"
+
+/* Play the track with the given title till the end. */
+static void test_play(struct cmusfm_server_session *session,
+		struct cmusfm_data_record *track, const char *title) {
+	strcpy(((char *)(track + 1)) + track->off_title, title);
+	track->status = CMSTATUS_PLAYING;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+	test_clock_time += track->duration;
+}
+
+int main(void) {
+
+	char track_buffer[CMSOCKET_BUFFER_SIZE] = { 0 };
+	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("");
+
+	cmusfm_server_set_clock(test_clock);
+
+	track->off_artist = 20;
+	track->off_album_artist = 40;
+	track->off_album = 60;
+	track->off_title = 80;
+	track->off_location = 100;
+	track->duration = 160;
+
+	strcpy(((char *)(track + 1)) + track->off_artist, "The Beatles");
+
+	config.submit_localfile = true;
+	config.nowplaying_localfile = true;
+	config.scrobble_batch_interval = 15;
+	config.scrobble_batch_size = 3;
+
+	test_play(session, track, "Taxman");
+	/* service recovery - the cache is drained */
+	loop_dispatch_timers();
+	assert(cmusfm_cache_drain_count == 1);
+	assert(scrobbler_update_now_playing_count == 1);
+
+	/* scrobbles are deferred, while now-playing updates are not */
+	test_play(session, track, "Eleanor Rigby");
+	test_play(session, track, "I'm Only Sleeping");
+	assert(scrobbler_scrobble_count == 0);
+	assert(scrobbler_update_now_playing_count == 3);
+	assert(cache_queue == 2);
+	assert(scrobble_batch_timer != -1);
+	assert(cache_drain_timer == -1);
+
+	/* batch is submitted when the size limit is reached */
+	test_play(session, track, "Love You To");
+	assert(scrobble_batch_timer == -1);
+	loop_dispatch_timers();
+	assert(cmusfm_cache_drain_count == 2);
+	assert(cache_queue == 0);
+
+	/* batch is submitted after the interval */
+	test_play(session, track, "Here, There and Everywhere");
+	assert(cache_queue == 1);
+	assert(scrobble_batch_timer != -1);
+	cmusfm_loop_remove_timer(scrobble_batch_timer);
+	cmusfm_server_scrobble_batch_cb(NULL);
+	loop_dispatch_timers();
+	assert(cmusfm_cache_drain_count == 3);
+
+	/* scrobbles are submitted immediately when batching is disabled */
+	config.scrobble_batch_interval = 0;
+	test_play(session, track, "Yellow Submarine");
+	assert(scrobbler_scrobble_count == 1);
+	assert(cache_queue == 0);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+/*
+ * cmusfm - test-server-events.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+#include <sys/socket.h>
+
+#define DEBUG_SKIP_HICCUP
+#include "test-server.inc"
+
+/* Subscribe the given socket via the server message. */
+static void test_subscribe(int fd) {
+	struct cmusfm_message msg = { .type = CMMESSAGE_SUBSCRIBE };
+	cmusfm_server_process_message(NULL, fd, (char *)&msg, sizeof(msg));
+	close(fd);
+}
+
+/* Read all pending events into the buffer. */
+static char *test_read_events(int fd, char *buffer, size_t size) {
+	ssize_t len = recv(fd, buffer, size - 1, MSG_DONTWAIT);
+	buffer[len > 0 ? len : 0] = '\0';
+	return buffer;
+}
+
+int main(void) {
+
+	char track_buffer[CMSOCKET_BUFFER_SIZE] = { 0 };
+	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("p1");
+	char events[CMUSFM_EVENTS_BUFFER_SIZE];
+	int sv[2], sv2[2];
+	size_t i;
+
+	cmusfm_server_set_clock(test_clock);
+
+	track->off_artist = 20;
+	track->off_album_artist = 40;
+	track->off_album = 60;
+	track->off_title = 80;
+	track->off_location = 100;
+
+	strcpy(((char *)(track + 1)) + track->off_artist, "The \"Beatles\"");
+	strcpy(((char *)(track + 1)) + track->off_title, "Yellow Submarine");
+
+	config.submit_localfile = true;
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	test_subscribe(sv[0]);
+	assert(cmusfm_events_subscribers() == 1);
+
+	/* subscription is not possible without the client socket */
+	test_subscribe(-1);
+	assert(cmusfm_events_subscribers() == 1);
+
+	track->status = CMSTATUS_PLAYING;
+	track->duration = 160;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_read_events(sv[1], events, sizeof(events));
+	assert(strstr(events, "{\"event\": \"service\", ") != NULL);
+	assert(strstr(events, "\"online\": true") != NULL);
+	assert(strstr(events, "{\"event\": \"track\", ") != NULL);
+	assert(strstr(events, "\"artist\": \"The \\\"Beatles\\\"\"") != NULL);
+	assert(strstr(events, "\"duration\": 160") != NULL);
+	assert(strstr(events, "\"session\": \"p1\", \"status\": \"playing\"}\n") != NULL);
+
+	/* pause shall not be announced as a new track */
+	test_clock_time += 100;
+	track->status = CMSTATUS_PAUSED;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_read_events(sv[1], events, sizeof(events));
+	assert(strstr(events, "\"event\": \"track\"") == NULL);
+	assert(strstr(events, "\"status\": \"paused\"") != NULL);
+
+	track->status = CMSTATUS_STOPPED;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_read_events(sv[1], events, sizeof(events));
+	assert(scrobbler_scrobble_count == 1);
+	assert(strstr(events, "{\"event\": \"scrobble\", ") != NULL);
+	assert(strstr(events, "\"timestamp\": 1444444444") != NULL);
+	assert(strstr(events, "\"status\": \"stopped\"") != NULL);
+
+	/* slow consumer shall be disconnected instead of stalling the server */
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv2) == 0);
+	test_subscribe(sv2[0]);
+	assert(cmusfm_events_subscribers() == 2);
+	for (i = 0; i < 10000 && cmusfm_events_subscribers() == 2; i++) {
+		cmusfm_server_process_data(NULL, session, track);
+		test_read_events(sv[1], events, sizeof(events));
+	}
+	assert(cmusfm_events_subscribers() == 1);
+
+	/* disconnected subscriber is removed upon the hang-up */
+	close(sv[1]);
+	events_subscriber_cb(subscribers[0].fd, NULL);
+	assert(cmusfm_events_subscribers() == 0);
+
+	close(sv2[1]);
+	return EXIT_SUCCESS;
+}
@@ -13,6 +13,9 @@ int main(void) {
 
 	char track_buffer[512];
 	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("");
+
+	cmusfm_server_set_clock(test_clock);
 
 	track->off_artist = 20;
 	track->off_album_artist = 40;
@@ -33,14 +36,14 @@ int main(void) {
 	track->status = CMSTATUS_PLAYING;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_update_now_playing_count == 1);
 	assert(strcmp(scrobbler_update_now_playing_sbt.artist, "The Beatles") == 0);
 	assert(strcmp(scrobbler_update_now_playing_sbt.track, "Yellow Submarine") == 0);
 
 	config.nowplaying_localfile = false;
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_update_now_playing_count == 1);
 
 #if ENABLE_LIBNOTIFY
@@ -50,7 +53,7 @@ int main(void) {
 	track->status |= CMSTATUS_SHOUTCASTMASK;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_update_now_playing_count == 2);
 #if ENABLE_LIBNOTIFY
 	assert(cmusfm_notify_show_count == 1);
@@ -63,29 +66,50 @@ int main(void) {
 	track->status = CMSTATUS_PLAYING;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_update_now_playing_count == 3);
 
 	/* track was played for a few seconds */
-	sleep(10);
+	test_clock_time += 10;
 
 	track->status = CMSTATUS_PAUSED;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_update_now_playing_count == 3);
 
 	/* track was unpaused after more than 120 seconds */
-	sleep(121);
+	test_clock_time += 121;
 
 	track->status = CMSTATUS_PLAYING;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_update_now_playing_count == 4);
 #if ENABLE_LIBNOTIFY
 	assert(cmusfm_notify_show_count == 3);
 #endif
 
+	/* now-playing update shall not wait for the previous track scrobble */
+
+	config.submit_localfile = true;
+
+	track->duration = 160;
+	cmusfm_server_update_record_checksum(track);
+
+	cmusfm_server_process_data(NULL, session, track);
+	assert(scrobbler_update_now_playing_count == 5);
+
+	/* next track started after the half of the previous one */
+	test_clock_time += 100;
+	strcpy(((char *)(track + 1)) + track->off_title, "Penny Lane");
+	cmusfm_server_update_record_checksum(track);
+
+	cmusfm_server_process_data(NULL, session, track);
+	assert(scrobbler_update_now_playing_count == 6);
+	assert(strcmp(scrobbler_update_now_playing_sbt.track, "Penny Lane") == 0);
+	assert(strcmp(scrobbler_scrobble_sbt.track, "Yellow Submarine") == 0);
+	assert(scrobbler_scrobble_nowplaying_count == 6);
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,117 @@
+/*
+ * cmusfm - test-server-recovery.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+
+#define DEBUG_SKIP_HICCUP
+#include "test-server.inc"
+
+/* Send the track record with the given title and status. */
+static void test_send(struct cmusfm_server_session *session,
+		struct cmusfm_data_record *track, const char *title, enum cmstatus status) {
+	strcpy(((char *)(track + 1)) + track->off_title, title);
+	track->status = status;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+}
+
+int main(void) {
+
+	char track_buffer[CMSOCKET_BUFFER_SIZE] = { 0 };
+	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("");
+
+	cmusfm_server_set_clock(test_clock);
+
+	track->off_artist = 20;
+	track->off_album_artist = 40;
+	track->off_album = 60;
+	track->off_title = 80;
+	track->off_location = 100;
+	track->duration = 160;
+
+	strcpy(((char *)(track + 1)) + track->off_artist, "The Beatles");
+
+	config.submit_localfile = true;
+	config.nowplaying_localfile = true;
+
+	/* the now-playing update verifies the service - there is no probe */
+	test_send(session, track, "Taxman", CMSTATUS_PLAYING);
+	assert(scrobbler_update_now_playing_count == 1);
+	assert(scrobbler_test_session_key_count == 0);
+	assert(scrobbler_fail_time == 0);
+	loop_dispatch_timers();
+	assert(cmusfm_cache_drain_count == 1);
+
+	/* service failure - the scrobble is cached */
+	scrobbler_service_status = SCROBBLER_STATUS_ERR_CURLPERF;
+	test_clock_time += 100;
+	test_send(session, track, "Eleanor Rigby", CMSTATUS_PLAYING);
+	assert(scrobbler_update_now_playing_count == 2);
+	assert(scrobbler_scrobble_count == 0);
+	assert(scrobbler_fail_time != 0);
+	assert(cache_queue == 1);
+
+	/* failed recovery attempt - the cache drain is the only request */
+	test_clock_time += 10;
+	test_send(session, track, "Eleanor Rigby", CMSTATUS_PAUSED);
+	loop_dispatch_timers();
+	assert(cmusfm_cache_drain_count == 2);
+	assert(scrobbler_test_session_key_count == 0);
+	assert(scrobbler_fail_time == test_clock_time);
+
+	/* no requests within the retry delay */
+	test_clock_time += 10;
+	test_send(session, track, "Eleanor Rigby", CMSTATUS_PLAYING);
+	test_clock_time += 100;
+	test_send(session, track, "I'm Only Sleeping", CMSTATUS_PLAYING);
+	assert(scrobbler_update_now_playing_count == 2);
+	assert(cache_queue == 2);
+
+	/* the recovery with the now-playing update */
+	scrobbler_service_status = SCROBBLER_STATUS_OK;
+	test_clock_time += SERVICE_RETRY_DELAY + 100;
+	test_send(session, track, "Love You To", CMSTATUS_PLAYING);
+	assert(scrobbler_update_now_playing_count == 3);
+	assert(scrobbler_scrobble_count == 1);
+	assert(scrobbler_test_session_key_count == 0);
+	assert(scrobbler_fail_time == 0);
+	loop_dispatch_timers();
+	assert(cmusfm_cache_drain_count == 3);
+	assert(cache_queue == 0);
+
+	/* the probe is sent only if there is nothing else to send */
+	scrobbler_fail_time = 1;
+	test_send(session, track, "Love You To", CMSTATUS_PAUSED);
+	assert(scrobbler_test_session_key_count == 1);
+	assert(scrobbler_fail_time == 0);
+
+	scrobbler_service_status = SCROBBLER_STATUS_ERR_CURLPERF;
+	scrobbler_fail_time = 1;
+	test_send(session, track, "Love You To", CMSTATUS_STOPPED);
+	assert(scrobbler_test_session_key_count == 2);
+	assert(scrobbler_fail_time == test_clock_time);
+
+	/* rate limit errors do not put the service offline */
+	scrobbler_service_status = SCROBBLER_STATUS_OK;
+	test_clock_time += SERVICE_RETRY_DELAY + 100;
+	test_send(session, track, "Here, There and Everywhere", CMSTATUS_PLAYING);
+	assert(scrobbler_fail_time == 0);
+	loop_dispatch_timers();
+	scrobbler_service_status = SCROBBLER_STATUS_ERR_SCROBAPI;
+	scrobbler_service_rate_limited = true;
+	test_clock_time += 100;
+	test_send(session, track, "Yellow Submarine", CMSTATUS_PLAYING);
+	assert(scrobbler_fail_time == 0);
+	assert(cache_queue == 1);
+	loop_dispatch_timers();
+	assert(cmusfm_cache_drain_count == 5);
+	assert(scrobbler_fail_time == 0);
+	assert(cache_queue == 1);
+	assert(cache_drain_timer != -1);
+
+	return EXIT_SUCCESS;
+}
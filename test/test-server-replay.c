@@ -0,0 +1,103 @@
+/*
+ * cmusfm - test-server-replay.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+
+#define DEBUG_SKIP_HICCUP
+#include "test-server.inc"
+
+int main(void) {
+
+	char track_buffer[CMSOCKET_BUFFER_SIZE] = { 0 };
+	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("player");
+	struct cmusfm_capture_record header = { CMUSFM_CAPTURE_SIGNATURE, 1, 256, 0 };
+	struct cmusfm_replay_stats stats;
+	char *capture_file = tempnam(NULL, "tmp-");
+	FILE *f;
+
+	cmusfm_server_set_clock(test_clock);
+
+	track->off_artist = 20;
+	track->off_album_artist = 40;
+	track->off_album = 60;
+	track->off_title = 80;
+	track->off_location = 100;
+
+	strcpy(((char *)(track + 1)) + track->off_artist, "The Beatles");
+	strcpy(((char *)(track + 1)) + track->off_title, "Yellow Submarine");
+
+	config.nowplaying_localfile = true;
+	config.submit_localfile = true;
+
+	/* record the listening session */
+	strcpy(config.capture_file, capture_file);
+	cmusfm_server_capture_open();
+	assert(capture_fd != -1);
+
+	track->status = CMSTATUS_PLAYING;
+	track->duration = 160;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_clock_time += 100;
+	strcpy(((char *)(track + 1)) + track->off_title, "Eleanor Rigby");
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_clock_time += 50;
+	track->status = CMSTATUS_PAUSED;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_clock_time += 600;
+	track->status = CMSTATUS_PLAYING;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_clock_time += 100;
+	track->status = CMSTATUS_STOPPED;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	assert(scrobbler_scrobble_count == 2);
+	assert(scrobbler_update_now_playing_count == 3);
+
+	config.capture_file[0] = '\0';
+	cmusfm_server_capture_open();
+	assert(capture_fd == -1);
+
+	/* replay the capture with fresh sessions */
+	memset(sessions, 0, sizeof(sessions));
+	sessions_len = 0;
+	assert(cmusfm_server_replay(capture_file, 0, &stats) == 0);
+	assert(stats.read == 5);
+	assert(stats.invalid == 0);
+	assert(stats.nowplaying == 3);
+	assert(stats.scrobbled == 2);
+	assert(stats.cached == 0);
+
+	/* scrobbling service was not used during the replay */
+	assert(scrobbler_scrobble_count == 2);
+	assert(scrobbler_update_now_playing_count == 3);
+
+	/* truncated record at the end of the capture is reported */
+	assert((f = fopen(capture_file, "a")) != NULL);
+	fwrite(&header, sizeof(header), 1, f);
+	fclose(f);
+
+	memset(sessions, 0, sizeof(sessions));
+	sessions_len = 0;
+	assert(cmusfm_server_replay(capture_file, 0, &stats) == 0);
+	assert(stats.read == 5);
+	assert(stats.invalid == 1);
+	assert(stats.scrobbled == 2);
+
+	assert(cmusfm_server_replay("/nonexistent", 0, &stats) == -1);
+
+	unlink(capture_file);
+	return EXIT_SUCCESS;
+}
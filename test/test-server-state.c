@@ -0,0 +1,129 @@
+/*
+ * cmusfm - test-server-state.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+
+#define DEBUG_SKIP_HICCUP
+#include "test-server.inc"
+
+/* simulate server restart - reset the play-state and restore it from
+ * the state file */
+static void test_server_restart(void) {
+	memset(sessions, 0, sizeof(sessions));
+	sessions_len = 0;
+	cmusfm_server_restore_state();
+}
+
+int main(void) {
+
+	char track_buffer[CMSOCKET_BUFFER_SIZE] = { 0 };
+	char track2_buffer[CMSOCKET_BUFFER_SIZE] = { 0 };
+	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_data_record *track2 = (struct cmusfm_data_record *)track2_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("");
+	struct cmusfm_server_session *session2;
+	FILE *f;
+
+	cmusfm_state_file = tempnam(".", "tmp-");
+	cmusfm_server_set_clock(test_clock);
+
+	track->off_artist = 20;
+	track->off_album_artist = 40;
+	track->off_album = 60;
+	track->off_title = 80;
+	track->off_location = 100;
+
+	strcpy(((char *)(track + 1)) + track->off_artist, "The Beatles");
+	strcpy(((char *)(track + 1)) + track->off_title, "Yellow Submarine");
+
+	config.submit_localfile = true;
+
+	track->status = CMSTATUS_PLAYING;
+	track->duration = 160;
+	cmusfm_server_update_record_checksum(track);
+
+	cmusfm_server_process_data(NULL, session, track);
+
+	/* server exits in the middle of the track */
+	test_clock_time += 100;
+	test_server_restart();
+
+	track->status = CMSTATUS_STOPPED;
+	cmusfm_server_update_record_checksum(track);
+
+	/* play of the track started before restart shall be scrobbled */
+	cmusfm_server_process_data(NULL, session, track);
+	assert(scrobbler_scrobble_count == 1);
+	assert(scrobbler_scrobble_sbt.timestamp == test_clock_time - 100);
+	assert(strcmp(scrobbler_scrobble_sbt.track, "Yellow Submarine") == 0);
+
+	/* pause time shall be preserved as well */
+	track->status = CMSTATUS_PLAYING;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+	test_clock_time += 60;
+	track->status = CMSTATUS_PAUSED;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+
+	test_clock_time += 600;
+	test_server_restart();
+
+	/* unpause shall not be treated as a replay */
+	track->status = CMSTATUS_PLAYING;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+	assert(scrobbler_scrobble_count == 1);
+
+	test_clock_time += 30;
+	track->status = CMSTATUS_STOPPED;
+	cmusfm_server_update_record_checksum(track);
+
+	/* track was played for more than half its duration */
+	cmusfm_server_process_data(NULL, session, track);
+	assert(scrobbler_scrobble_count == 2);
+
+	/* sessions shall not interfere with each other */
+	memcpy(track2_buffer, track_buffer, sizeof(track2_buffer));
+	strcpy(((char *)(track2 + 1)) + track2->off_title, "Penny Lane");
+	session2 = cmusfm_server_get_session("/home/user/.config/cmus-2");
+	assert(session2 != session);
+
+	track->status = CMSTATUS_PLAYING;
+	cmusfm_server_update_record_checksum(track);
+	cmusfm_server_process_data(NULL, session, track);
+	test_clock_time += 10;
+	track2->status = CMSTATUS_PLAYING;
+	cmusfm_server_update_record_checksum(track2);
+	cmusfm_server_process_data(NULL, session2, track2);
+	assert(scrobbler_scrobble_count == 2);
+
+	test_clock_time += 90;
+	test_server_restart();
+	assert(session->state.started == test_clock_time - 100);
+	assert(cmusfm_server_get_session("/home/user/.config/cmus-2") == session2);
+	assert(session2->state.started == test_clock_time - 90);
+
+	track2->status = CMSTATUS_STOPPED;
+	cmusfm_server_update_record_checksum(track2);
+	cmusfm_server_process_data(NULL, session2, track2);
+	assert(scrobbler_scrobble_count == 3);
+	assert(strcmp(scrobbler_scrobble_sbt.track, "Penny Lane") == 0);
+	assert(session->state.started == test_clock_time - 100);
+
+	/* damaged state file shall be ignored */
+	assert((f = fopen(cmusfm_state_file, "r+")) != NULL);
+	fseek(f, 100, SEEK_SET);
+	fputc('X', f);
+	fclose(f);
+
+	test_server_restart();
+	assert(sessions_len == 0);
+	assert(session->state.started == 0);
+
+	unlink(cmusfm_state_file);
+	return EXIT_SUCCESS;
+}
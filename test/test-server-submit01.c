@@ -13,6 +13,9 @@ int main(void) {
 
 	char track_buffer[512];
 	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("");
+
+	cmusfm_server_set_clock(test_clock);
 
 	track->off_artist = 20;
 	track->off_album_artist = 40;
@@ -34,42 +37,42 @@ int main(void) {
 	track->duration = 35;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 
 	/* track was played for more than half its duration */
-	sleep(track->duration / 2 + 1);
+	test_clock_time += track->duration / 2 + 1;
 
 	track->status = CMSTATUS_PLAYING;
 	track->duration = 35;
 	strcpy(((char *)(track + 1)) + track->off_title, "For No One");
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_scrobble_count == 1);
 
 	/* track was played for less than half its duration */
-	sleep(track->duration / 2 - 1);
+	test_clock_time += track->duration / 2 - 1;
 
 	track->duration = 30;
 	strcpy(((char *)(track + 1)) + track->off_title, "Doctor Robert");
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_scrobble_count == 1);
 
 	/* whole track was played but its duration isn't longer than 30 seconds */
-	sleep(track->duration);
+	test_clock_time += track->duration;
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_scrobble_count == 1);
 
 	/* short track was overplayed (due to seeking) */
-	sleep(track->duration + 10);
+	test_clock_time += track->duration + 10;
 
 	track->status = CMSTATUS_STOPPED;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_scrobble_count == 1);
 
 	return EXIT_SUCCESS;
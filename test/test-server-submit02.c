@@ -13,6 +13,9 @@ int main(void) {
 
 	char track_buffer[512];
 	struct cmusfm_data_record *track = (struct cmusfm_data_record *)track_buffer;
+	struct cmusfm_server_session *session = cmusfm_server_get_session("");
+
+	cmusfm_server_set_clock(test_clock);
 
 	track->off_artist = 20;
 	track->off_album_artist = 40;
@@ -34,15 +37,15 @@ int main(void) {
 	track->duration = 4 * 60 * 5;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 
 	/* track was played for more than 4 minutes but less than half its duration */
-	sleep(4 * 60 + 1);
+	test_clock_time += 4 * 60 + 1;
 
 	track->status = CMSTATUS_STOPPED;
 	cmusfm_server_update_record_checksum(track);
 
-	cmusfm_server_process_data(NULL, track);
+	cmusfm_server_process_data(NULL, session, track);
 	assert(scrobbler_scrobble_count == 1);
 
 	return EXIT_SUCCESS;
@@ -18,9 +18,40 @@ void *cmusfm_server_worker(void *arg) {
 
 pthread_t server_thread;
 void cmusfm_server_cleanup(int sig) {
+	char lock_file[256];
 	(void)sig;
 	pthread_kill(server_thread, SIGTERM);
 	sleep(1);
+	/* server lock file is not removed by the server itself */
+	snprintf(lock_file, sizeof(lock_file), "%s.lock", cmusfm_socket_file);
+	unlink(lock_file);
+}
+
+/* send track info to the server as cmus status display program would do */
+int cmusfm_server_send_track(const struct cmtrack_info *tinfo) {
+
+	char disc_number[16], track_number[16], duration[16];
+	char *argv[32] = { "status", "playing" };
+	int argc = 2;
+
+	snprintf(disc_number, sizeof(disc_number), "%d", tinfo->disc_number);
+	snprintf(track_number, sizeof(track_number), "%d", tinfo->track_number);
+	snprintf(duration, sizeof(duration), "%d", tinfo->duration);
+
+#define ARG(key, value) if ((value) != NULL) { argv[argc++] = key; argv[argc++] = (char *)(value); }
+	ARG("file", tinfo->file);
+	ARG("url", tinfo->url);
+	ARG("artist", tinfo->artist);
+	ARG("albumartist", tinfo->album_artist);
+	ARG("album", tinfo->album);
+	ARG("discnumber", tinfo->disc_number ? disc_number : NULL);
+	ARG("tracknumber", tinfo->track_number ? track_number : NULL);
+	ARG("title", tinfo->title);
+	ARG("musicbrainz_trackid", tinfo->mb_track_id);
+	ARG("date", tinfo->date);
+	ARG("duration", tinfo->duration ? duration : NULL);
+
+	return cmusfm_server_send_status(argc, argv);
 }
 
 int test_track_minimum(void) {
@@ -164,6 +195,32 @@ int test_out_of_bounds_write(void) {
 	return 2;
 }
 
+int test_stalled_client(void) {
+
+	struct sockaddr_un saddr = { .sun_family = AF_UNIX };
+	int sock;
+
+	struct cmtrack_info track = {
+		.status = CMSTATUS_PLAYING,
+		.artist = "The Beatles",
+		.title = "Yellow Submarine",
+	};
+
+	strncpy(saddr.sun_path, cmusfm_socket_file, sizeof(saddr.sun_path) - 1);
+	assert((sock = socket(PF_UNIX, SOCK_STREAM, 0)) != -1);
+	assert(connect(sock, (struct sockaddr *)&saddr, sizeof(saddr)) == 0);
+	/* send only a part of the message header and keep the connection open */
+	assert(write(sock, "\x01", 1) == 1);
+
+	cmusfm_server_send_track(&track);
+	sleep(1); /* allow server to process data */
+
+	assert(strcmp(scrobbler_update_now_playing_sbt.track, track.title) == 0);
+
+	close(sock);
+	return 1;
+}
+
 int main(void) {
 
 	/* place communication socket in the current directory */
@@ -193,6 +250,8 @@ int main(void) {
 	assert(scrobbler_update_now_playing_count == count);
 	count += test_out_of_bounds_write();
 	assert(scrobbler_update_now_playing_count == count);
+	count += test_stalled_client();
+	assert(scrobbler_update_now_playing_count == count);
 
 	cmusfm_server_cleanup(0);
 	return EXIT_SUCCESS;
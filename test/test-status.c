@@ -0,0 +1,99 @@
+/*
+ * cmusfm - test-status.c
+ * SPDX-FileCopyrightText: 2015-2024 Arkadiusz Bokowy and contributors
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/status.c"
+#include "../src/utils.c"
+
+/* global variables used in the status board code */
+const char *cmusfm_socket_file;
+
+static bool writer_quit = false;
+
+/* Publish statuses with all fields derived from the same counter value. */
+static void *writer(void *arg) {
+
+	struct cmusfm_status status = { 0 };
+	uint32_t i;
+	(void)arg;
+
+	for (i = 1; !__atomic_load_n(&writer_quit, __ATOMIC_RELAXED); i++) {
+		status.queue = status.playtime = status.submit_playtime = i;
+		status.updated = status.unpaused = i;
+		memset(status.artist, 'a' + i % 26, sizeof(status.artist) - 1);
+		memset(status.title, 'a' + i % 26, sizeof(status.title) - 1);
+		cmusfm_status_publish(&status);
+	}
+
+	return NULL;
+}
+
+int main(void) {
+
+	char socket_file[64];
+	const struct cmusfm_status *board;
+	struct cmusfm_status status;
+	pthread_t thread;
+	int i;
+
+	snprintf(socket_file, sizeof(socket_file), "test-status-%d", (int)getpid());
+	cmusfm_socket_file = socket_file;
+
+	/* there is no board without the server */
+	assert(cmusfm_status_attach() == NULL);
+
+	assert(cmusfm_status_open() == 0);
+	assert((board = cmusfm_status_attach()) != NULL);
+
+	status = (struct cmusfm_status){ .queue = 3, .status = 1, .duration = 180 };
+	strcpy(status.artist, "The Beatles");
+	strcpy(status.title, "Yellow Submarine");
+	cmusfm_status_publish(&status);
+
+	memset(&status, 0, sizeof(status));
+	assert(cmusfm_status_load(board, &status) == 0);
+	assert(status.queue == 3);
+	assert(status.status == 1);
+	assert(status.duration == 180);
+	assert(strcmp(status.artist, "The Beatles") == 0);
+	assert(strcmp(status.title, "Yellow Submarine") == 0);
+	assert(cmusfm_status_is_live(&status));
+
+	/* status published by the server which is not running anymore */
+	if ((status.pid = fork()) == 0)
+		_exit(EXIT_SUCCESS);
+	assert(waitpid(status.pid, NULL, 0) == status.pid);
+	assert(!cmusfm_status_is_live(&status));
+
+	/* reader shall never see the partially updated status */
+	memset(&status, 0, sizeof(status));
+	cmusfm_status_publish(&status);
+	assert(pthread_create(&thread, NULL, writer, NULL) == 0);
+	for (i = 0; i < 100000; i++) {
+		if (cmusfm_status_load(board, &status) == -1)
+			continue;
+		assert(status.queue == status.playtime);
+		assert(status.queue == status.submit_playtime);
+		assert(status.updated == status.unpaused);
+		assert(status.artist[0] == status.title[0]);
+		assert(status.artist[sizeof(status.artist) - 2] == status.title[0]);
+	}
+	__atomic_store_n(&writer_quit, true, __ATOMIC_RELAXED);
+	pthread_join(thread, NULL);
+
+	cmusfm_status_close();
+	assert(cmusfm_status_attach() == NULL);
+
+	return EXIT_SUCCESS;
+}